@@ -1,6 +1,25 @@
 #ifndef TTC_SCHEDULER_H
 #define TTC_ULTRASOUND_H
 
+// Execution statistics of a task, times in Timer 1 counts
+typedef struct
+{
+   // Shortest, longest and total execution time
+   unsigned int ExecMin;
+   unsigned int ExecMax;
+   unsigned long ExecTotal;
+   // Number of measured runs
+   unsigned int Runs;
+   // Longest delay between release and start (release jitter)
+   unsigned int JitterMax;
+   // Number of releases while the previous release had not run yet
+   unsigned int Missed;
+   // Largest RunMe backlog seen by the dispatcher
+   unsigned char BacklogMax;
+   // Timer count of the last release
+   unsigned int Release;
+} sTaskStats;
+
 // Scheduler data structure for storing task data
 typedef struct
 {
@@ -12,6 +31,12 @@ typedef struct
    unsigned int Period;
    // Runme flag (indicating when the task is due to run)
    unsigned char RunMe;
+   // Dispatch priority, higher values run first
+   unsigned char Priority;
+   // Next task in the delta queue or on the free list
+   unsigned char Next;
+   // Execution statistics (SCH_STATS)
+   sTaskStats Stats;
 } sTask;
 
 // Function prototypes
@@ -22,11 +47,37 @@ void SCH_Start(void);
 // Core scheduler functions
 void SCH_Dispatch_Tasks(void);
 unsigned char SCH_Add_Task(void (*)(void), const unsigned int, const unsigned int);
+unsigned char SCH_Add_Event_Task(void (*)(void));
+unsigned char SCH_Signal_Task(const unsigned char);
 unsigned char SCH_Delete_Task(const unsigned char);
+unsigned char SCH_Set_Priority(const unsigned char, const unsigned char);
+unsigned char SCH_Get_Stats(const unsigned char, sTaskStats *, const unsigned char);
 
 // hier het aantal taken aanpassen ....!!
 // Maximum number of tasks
 
-#define SCH_MAX_TASKS (6)
+#define SCH_MAX_TASKS (8)
+
+// Scheduler engine: 1 keeps the tasks in a delta queue (the ISR only
+// touches the head of the queue), 0 scans the whole task array every tick
+#define SCH_DELTA_QUEUE (1)
+
+// Record execution time, release jitter and missed releases per task
+#define SCH_STATS (1)
+
+// Microseconds per Timer 1 count
+#define SCH_US_PER_COUNT (4)
+
+// End of the delta queue and the free list
+#define SCH_END (SCH_MAX_TASKS)
+
+// Timer 1 counts per 10 ms tick (prescaler 64)
+#define SCH_TICK_COUNTS (2500)
+
+// Period of an event task, it only runs when signalled
+#define SCH_EVENT (0xFFFF)
+
+// Maximum number of idle ticks skipped by one compare match (65535 / SCH_TICK_COUNTS)
+#define SCH_MAX_SKIP (26)
 
 #endif
\ No newline at end of file
@@ -0,0 +1,38 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdint.h>
+#include "avr/io.h"
+#include "fixed.h"
+#include "sensor.h"
+
+#define CONFIG_VERSION 3                                    //The layout version of the record, records of other versions are ignored
+#define CONFIG_SLOT_SIZE 32                                 //The EEPROM bytes per slot, every save writes the next slot
+#define CONFIG_SLOTS ((E2END + 1) / CONFIG_SLOT_SIZE)       //The amount of slots, the record rotates over the whole EEPROM
+
+typedef struct{
+    fixed_t max;                                //The value that rolls the blinds down, 0 when the sensor does not trigger
+    fixed_t min;                                //The value that rolls the blinds up, 0 when the sensor does not trigger
+} SensorLimits; //The trigger limits of a sensor
+
+typedef struct{
+    SensorLimits sensors[SENSOR_COUNT];         //The trigger limits indexed by sensor index
+    fixed_t distanceMax;                        //The maximum distance before stopping a transition
+    fixed_t distanceMin;                        //The minimum distance before stopping a transition
+    unsigned char selected;                     //The sensor the trigger sensor commands and the UUID refer to after reset
+    unsigned char address;                      //The bus address, 0 when the station is not on a bus
+} Config; //The settings that are kept in EEPROM
+
+typedef struct{
+    uint16_t sequence;                          //Incremented by every save, the valid record with the highest sequence is the current one
+    uint16_t version;                           //CONFIG_VERSION
+    Config config;                              //The settings
+    uint16_t crc;                               //CRC16 of all bytes before it
+} ConfigRecord; //A config record as stored in an EEPROM slot
+
+_Static_assert(sizeof(ConfigRecord) <= CONFIG_SLOT_SIZE, "A config record has to fit its EEPROM slot, raise CONFIG_SLOT_SIZE");
+
+unsigned char config_load(Config* config);      //Load the newest valid record, returns 0 and clears the config when there is none
+void config_save(const Config* config);         //Queue the config as a new record in the next slot, returns right away
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef FILTER_H
+#define FILTER_H
+
+#define FILTER_SHIFT 3                          //The filter length as a power of two
+#define FILTER_LENGTH (1 << FILTER_SHIFT)       //The amount of samples in the moving average
+
+typedef struct{
+    unsigned short samples[FILTER_LENGTH];      //The last samples, the oldest is at index
+    unsigned long sum;                          //The sum of the samples
+    unsigned char index;                        //The position of the next sample
+    unsigned char filled;                       //Set once the first sample filled the buffer
+} MovingAverage; //Moving average over the last FILTER_LENGTH samples
+
+void filter_reset(MovingAverage* filter);                                   //Empty the filter, the next sample fills it
+unsigned short filter_update(MovingAverage* filter, unsigned short sample); //Add a sample and return the average
+
+#endif
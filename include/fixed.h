@@ -0,0 +1,18 @@
+#ifndef FIXED_H
+#define FIXED_H
+
+#include <stdint.h>
+
+#define FIXED_FRAC_BITS 4                               //The fraction bits, a resolution of 1/16
+#define FIXED_ONE (1 << FIXED_FRAC_BITS)                //The fixed point value of 1
+#define FIXED_MAX INT16_MAX                             //The largest fixed point value, 2047.9375
+#define FIXED_MIN INT16_MIN                             //The smallest fixed point value, -2048
+
+#define FIXED_FROM_INT(value) ((fixed_t) ((value) * FIXED_ONE))  //Converts an integer that fits the range to fixed point
+#define FIXED_TO_INT(value) ((value) >> FIXED_FRAC_BITS)         //Converts a fixed point value to an integer, rounding down
+
+typedef int16_t fixed_t; //Signed Q11.4 fixed point value, all samples and thresholds use this format
+
+fixed_t fixed_from_long(long value); //Converts an integer to fixed point, saturating at the range limits
+
+#endif
@@ -0,0 +1,27 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "fixed.h"
+#include "sensor.h"
+
+#define HISTORY_PERIOD 10                       //The seconds between two samples
+#define HISTORY_BLOCK_SIZE 32                   //The bytes per block
+#define HISTORY_BLOCKS 16                       //The amount of blocks, the oldest block is overwritten when the ring is full
+#define HISTORY_VALUES (1 + SENSOR_COUNT)       //The values of a sample, the distance and every sensor by sensor index
+#define HISTORY_HEADER_SIZE (5 + 2 * HISTORY_VALUES)    //Size byte, 4 byte sample number and the keyframe values
+#define HISTORY_SAMPLE_MAX (3 * HISTORY_VALUES)         //The largest delta sample, a varint of up to 3 bytes per value
+
+//A block starts with its size in bytes and the keyframe: the sample number since boot and the
+//distance and the value of every sensor as little endian fixed point. The next samples follow one
+//period apart as a zigzag varint delta per value. A gap in the samples starts a new block.
+//
+//The dump frame is the command byte, the amount of blocks, the period in seconds, the length of
+//the blocks as a little endian word, the blocks from old to new and the end of the frame. The parameter
+//byte of the command is the amount of newest blocks to send, 0 for all.
+#define HISTORY_DUMP_HEADER_SIZE 5
+
+void history_add(const fixed_t* values);                         //Add the sample of this period, HISTORY_VALUES values
+void history_dump_start(unsigned char command, unsigned char blocks); //Start sending the dump frame
+unsigned char history_dump();                                    //Continue a running dump, returns 1 while it has not been sent completely
+
+#endif
@@ -1,9 +1,11 @@
 #ifndef LIGHTSENSOR_H
 #define LIGHTSENSOR_H
 #include "pa_io.h"
+#include "fixed.h"
 
 #define LIGHT_SENSOR_PIN_A 1    //The sensor pin
 
-int readLightSensor();          //Read the raw sensor data from the light sensor
+int readLightSensor();          //Read the raw sensor data from the light sensor, 12 bit oversampled
+fixed_t toLightIntensity(int raw); //Convert raw sensor data to a light intensity with a resolution of 0-1024
 
 #endif
@@ -5,8 +5,19 @@
 #define HIGH 0x1                                        
 #define LOW  0x0
 
-void adc_init();                                        //Initialize the ADC
-unsigned short analogRead(unsigned char channel);       //Analog read the analog pins connected to the adc
+#define ADC_CHANNEL_BANDGAP 14                          //The internal 1.1V reference, measured against AVcc for the supply voltage
+#define ADC_CHANNELS {1, 0, ADC_CHANNEL_BANDGAP}        //The sampled channels in conversion order: light sensor, temperature sensor, supply voltage
+#define ADC_CHANNEL_COUNT 3                             //The amount of sampled channels
+#define ADC_TRIGGER_TOP 194                             //Timer0 compare value, 16MHz / 256 / 195 starts a conversion at 320Hz, a new light and temperature sample every 100ms
+#define ADC_BANDGAP_ROUNDS 8                            //The supply voltage changes slowly, the bandgap is only sampled in one of this many rounds over the channels
+#define ADC_OVERSAMPLE_BITS 2                           //The extra bits of resolution, every sample is the sum of 4^2 conversions
+#define ADC_OVERSAMPLE_COUNT (1 << (2 * ADC_OVERSAMPLE_BITS)) //The amount of conversions per sample
+#define ADC_BANDGAP_SCALE 4505600UL                     //The bandgap voltage in millivolt times 4096, the full scale of an oversampled sample
+
+void adc_init();                                        //Initialize the ADC and start sampling the channels in the background
+unsigned short analogRead(unsigned char channel);       //Returns the latest 10 bit sample of a sampled channel without waiting, 0 for other channels
+unsigned short analogReadOversampled(unsigned char channel); //Returns the latest 12 bit sample of a sampled channel without waiting, 0 for other channels
+unsigned short readSupplyVoltage();                     //Returns the supply voltage in millivolt
 void writePin(unsigned char pin, unsigned char val);    //Write the a pin on portb
 void togglePin(unsigned char pin);                      //Toggle the value of a pin on portb
 int readPin(unsigned char pin);                         //Read from a pin on portb
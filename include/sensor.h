@@ -0,0 +1,19 @@
+#ifndef SENSOR_H
+#define SENSOR_H
+
+#include "fixed.h"
+
+//Sensor indexes, the index selects the sensor over the protocol and its limits in the config
+#define SENSOR_LIGHT 0                          //The light sensor, light intensity with a resolution of 0-1024
+#define SENSOR_TEMPERATURE 1                    //The TMP36, degrees Celsius
+#define SENSOR_COUNT 2                          //The amount of sensors, all of them are sampled
+
+typedef struct{
+    int (*read)();                              //Read the raw sample, 12 bit oversampled
+    fixed_t (*convert)(int raw);                //Convert a filtered raw sample to the unit of the sensor
+    unsigned char type;                         //The sensor type byte of the UUID
+} Sensor; //Sensor descriptor
+
+extern const Sensor sensors[SENSOR_COUNT];      //The sensor registry indexed by sensor index
+
+#endif
@@ -1,12 +1,56 @@
 #ifndef SERIAL_H
 #define SERIAL_H
 
-#define UBBRVAL 51 // Value for baudrate, 51 = 19200 baudrate
+#include "fixed.h"
+
+#define SERIAL_RATES {103, 51, 34, 25, 16, 7, 3, 1} // UBRR0 values with U2X0 at 16 MHz for 19200, 38400, 57600, 76800, 115200, 250000, 500000 and 1000000 baud
+#define SERIAL_RATE_COUNT 8 // Amount of selectable rates
+#define SERIAL_RATE_DEFAULT 0 // The rate after reset and after a fall back, 19200 baud
+#define SERIAL_RATE_TIMEOUT 200 // Amount of receive_command calls without a valid frame after a rate change before falling back
+
+#define RX_BUFFER_SIZE 64 // Size of the receive ring buffer, must be a power of two, holds several pipelined v2 requests
+#define TX_BUFFER_SIZE 128 // Size of the transmit queue, must be a power of two
+#define RX_FRAME_TIMEOUT 10 // Amount of receive_command calls without new bytes before a partial frame is dropped
+
+// v2 framing: FRAME_SYNC, the escaped payload and FRAME_END. The payload is the sequence number,
+// the v1 frame without the stop byte and the CRC16 (0xFFFF start, little endian) of both. FRAME_END
+// and FRAME_ESC in the payload are sent as FRAME_ESC followed by FRAME_ESC_END or FRAME_ESC_ESC.
+// Replies repeat the sequence number of the request and use the framing of the last valid request,
+// so v1 hosts keep working unchanged. Frames with a wrong CRC or length are dropped.
+// A request may add one byte to its content, the index of the sensor the trigger sensor commands, the UUID
+// and the batch fields refer to. The selection of CMD_EXT_SENSOR is then left alone, so the clients of a
+// gateway that share a station do not redirect each other's reads.
+#define FRAME_SYNC 0x07 // Starts a v2 frame, a v1 command byte never has all error bits set
+#define FRAME_END 0xC0
+#define FRAME_ESC 0xDB
+#define FRAME_ESC_END 0xDC
+#define FRAME_ESC_ESC 0xDD
+#define FRAME_PUSH_SEQ 0x00 // Sequence number of frames that are not a reply, hosts number their requests from 1
+#define FRAME_SENSOR_NONE 0xFF // serial_sensor() of a request without sensor index
+#define FRAME_V2_SIZE(size) (2 * (size) + 6) // Largest v2 frame of a v1 frame of the given size, every payload byte escaped
+
+// Multi-drop bus: FRAME_SYNC_BUS starts a v2 frame whose payload starts with the station address, the CRC
+// covers it. A station with a bus address only takes bus frames with its address and answers in a bus frame
+// with that address, after the bus turnaround and with the RS-485 driver enabled until its last byte is out.
+// It never pushes. Broadcast frames are only taken for a discovery, the stations with an address in the window
+// of BUS_SLOTS addresses from the parameter byte answer with their UUID in the slot of their address.
+#define FRAME_SYNC_BUS 0x0F // Starts a bus frame, a v1 command byte never has all error bits set
+#define FRAME_BUS_SIZE(size) (FRAME_V2_SIZE(size) + 2) // Largest bus frame of a v1 frame of the given size, the escaped address on top
+#define BUS_BROADCAST 0x00 // The address of a broadcast, a station without bus address takes no bus frames
+#define BUS_ADDRESS_MAX 247 // The highest station address
+#define BUS_TURNAROUND 2 // Bus timer periods of 1.024 ms before a station drives the bus, the host releases it meanwhile
+#define BUS_SLOT 25 // Bus timer periods per discovery slot, a UUID reply at 19200 baud and the tick parse_command waits for
+#define BUS_SLOTS 32 // Amount of addresses a discovery covers
+#define BUS_DE_PIN PD2 // Driver enable of the RS-485 transceiver, its receiver enable is the inverted driver enable
 
 // Mask values
 #define CMD_FUNCTION_MASK 0x80
 #define CMD_VALUE_MASK 0x60
 #define CMD_ID_MASK 0x18
+#define CMD_MASK (CMD_FUNCTION_MASK | CMD_VALUE_MASK | CMD_ID_MASK)
+
+#define CMD_INDEX(cmd) (((cmd) & CMD_MASK) >> 3) // Index of a command byte in a command table
+#define CMD_COUNT 32 // Amount of possible command indexes
 
 // Command flags
 #define CMD_STOP 0xFF
@@ -17,6 +61,7 @@
 #define CMD_MODE_VALUE 0x00
 #define CMD_MODE_MIN 0x20
 #define CMD_MODE_MAX 0x40
+#define CMD_MODE_EXTENDED 0x60 // Extended reads carry one parameter byte, extended writes carry four content bytes
 
 // Id flags
 #define CMD_ID_STATUS 0x00
@@ -24,6 +69,38 @@
 #define CMD_ID_TRIGGER_SENSOR 0x10
 #define CMD_ID_UUID 0x18
 
+// Extended commands
+#define CMD_EXT_BATCH (CMD_READ | CMD_MODE_EXTENDED | 0x00) // Read the fields selected by the parameter byte in one frame
+#define CMD_EXT_TASK_STATS (CMD_READ | CMD_MODE_EXTENDED | 0x08) // Read the execution statistics of the task selected by the parameter byte
+#define CMD_EXT_HISTORY (CMD_READ | CMD_MODE_EXTENDED | 0x10) // Dump the sample history, see history.h for the frame
+#define CMD_EXT_DISCOVER (CMD_READ | CMD_MODE_EXTENDED | 0x18) // Read the UUID in the discovery slot of the bus address, the parameter byte is the first address of the window
+#define CMD_EXT_SUBSCRIBE (CMD_WRITE | CMD_MODE_EXTENDED | 0x00) // Push batch frames, content is field mask, period, distance deadband and trigger sensor deadband
+#define CMD_EXT_RATE (CMD_WRITE | CMD_MODE_EXTENDED | 0x08) // Switch the link rate after the reply, the first content byte is the index in SERIAL_RATES
+#define CMD_EXT_SENSOR (CMD_WRITE | CMD_MODE_EXTENDED | 0x10) // Select the sensor of the trigger sensor commands until reset, the first content byte is the sensor index, a second byte of SENSOR_STORE also keeps it after reset
+#define CMD_EXT_ADDRESS (CMD_WRITE | CMD_MODE_EXTENDED | 0x18) // Set the bus address, the first content byte is the address, 0 leaves the bus
+
+#define SENSOR_STORE 0x01 // Second content byte of CMD_EXT_SENSOR that stores the selection in eeprom as the default after reset
+#define SUBSCRIBE_DEADBAND_OFF 0xFF // Deadband value that disables report by exception for a value
+
+// Batch field flags, the selected fields are sent in this order
+#define BATCH_FIELD_STATUS 0x01
+#define BATCH_FIELD_DISTANCE 0x02
+#define BATCH_FIELD_TRIGGER_SENSOR 0x04
+#define BATCH_FIELD_MIN_DISTANCE 0x08
+#define BATCH_FIELD_MAX_DISTANCE 0x10
+#define BATCH_FIELD_MIN_TRIGGER_SENSOR 0x20
+#define BATCH_FIELD_MAX_TRIGGER_SENSOR 0x40
+#define BATCH_FIELD_UUID 0x80
+#define BATCH_MAX_SIZE 35 // Command byte, field mask, 8 fields of 4 bytes and the stop byte
+
+// Task statistics, the parameter byte holds the task index and the reset flag
+// The reply holds the minimum, maximum and average execution time and the maximum
+// release jitter in microseconds, the missed releases and the maximum backlog
+#define TASK_STATS_RESET 0x80 // Start the statistics over after reading them
+#define TASK_STATS_SIZE 27 // Command byte, parameter byte, 6 fields of 4 bytes and the stop byte
+
+#define REPLY_MAX_SIZE FRAME_BUS_SIZE(BATCH_MAX_SIZE) // Size of the largest reply in any framing
+
 // Error flags
 #define ERR_MASK 0x07
 #define ERR_VALID 0x00
@@ -34,18 +111,29 @@
 
 void serial_init(); // Initialize serial communication
 
-void transmit(unsigned char data); // Transmit a byte
-void transmit_string(unsigned char* str); // Transmit a string
-void transmit_byte_stream(unsigned char* buffer, int size); // Transmit a byte stream
+unsigned char transmit(unsigned char data); // Queue a byte for transmission, returns 0 when the queue is full
+unsigned char transmit_string(unsigned char* str); // Queue a string for transmission, returns 0 when it does not fit
+unsigned char transmit_byte_stream(unsigned char* buffer, int size); // Queue a byte stream for transmission, returns 0 when it does not fit
+unsigned char transmit_frame(unsigned char* buffer, int size, unsigned char push); // Queue a v1 frame in the framing of the last request, returns 0 when it does not fit
+unsigned char frame_begin(unsigned char push); // Start a frame that is queued in parts, returns 0 when the start does not fit
+unsigned char frame_append(unsigned char* buffer, unsigned char size); // Queue frame content, returns the amount of bytes that fit
+unsigned char frame_end(); // Finish the frame, returns 0 when the end does not fit
+unsigned char serial_tx_free(); // Returns the amount of free bytes in the transmit queue
+unsigned char serial_set_rate(unsigned char index); // Switch to a rate of SERIAL_RATES once the next frame, the reply, has been sent, returns 0 for an invalid index
+unsigned int serial_tx_dropped(); // Returns the amount of bytes dropped because the transmit queue was full
+unsigned char serial_set_address(unsigned char address); // Take the bus frames of an address, 0 leaves the bus, returns 0 for an invalid address
+unsigned char serial_bus_slot(unsigned char first); // Delay the next reply to the discovery slot of the address, returns 0 when it is not in the window
 
-void receive_command(unsigned char* buffer); // Receive a command
+unsigned char receive_command(unsigned char* buffer); // Receive a command without blocking, returns 1 when a complete frame was written to the buffer
+unsigned char serial_sensor(); // Returns the sensor index of the last request, FRAME_SENSOR_NONE when it has none
 
 void set_content_bytes(unsigned char* src, unsigned char* dest); // Write values from source buffer to byte 1 .. 4 of destination buffer
 void get_content_bytes(unsigned char* src, unsigned char* dest); // Writes bytes 1..4 from source buffer to destination buffer
 void set_error_flag(unsigned char* buffer, unsigned char error); // Sets the error flags of the first byte, sets the second byte to stop, and fill the rest with 0x00
 
-float bytes_to_float(unsigned char* bytes); // Converts a byte array to an IEEE floating point value
-void float_to_bytes(float value, unsigned char* buffer); // Converts an IEEE floating point value to byte array
+fixed_t bytes_to_fixed(unsigned char* bytes); // Converts a byte array with an IEEE floating point value to fixed point
+void fixed_to_bytes(fixed_t value, unsigned char* buffer); // Converts a fixed point value to a byte array with an IEEE floating point value
+void long_to_bytes(long value, unsigned char* buffer); // Converts an integer to a byte array with an IEEE floating point value
 
 void debug_transmit(int value); // Send a debug value via serial communication
 
@@ -1,10 +1,12 @@
 #ifndef TEMPSENSOR_H
 #define TEMPSENSOR_H
+#include "fixed.h"
 
 #define TEMP_SENSOR_PIN_A 0     //The sensor pin
 
-int readTempSensor();           //Read the raw sensor data from the temperature sensor
-float getDegreesInCelsius();    //Read the degrees in celsius
-float getDegreesInFahrenheit(); //Read the degrees in fahrenheit
+int readTempSensor();           //Read the raw sensor data from the temperature sensor, 12 bit oversampled
+fixed_t toDegreesInCelsius(int raw); //Convert raw sensor data to degrees in celsius
+fixed_t getDegreesInCelsius();  //Read the degrees in celsius
+fixed_t getDegreesInFahrenheit(); //Read the degrees in fahrenheit
 
 #endif
\ No newline at end of file
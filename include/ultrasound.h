@@ -1,8 +1,22 @@
 #ifndef ULTRASOUND_H
 #define ULTRASOUND_H
 
-void setup_ultrasound();        //Set up the ultrasound sensor
-void trigger_ultrasonor();      //Trigger the ultrasound sensor
-unsigned long get_distance();   //Returns the distance base on the pulse duration
+#include "fixed.h"
 
-#endif
\ No newline at end of file
+#define ULTRASOUND_TRIGGER_PIN PB2      //The trigger pin, OC1B (pin 10) generates the pulse
+#define ULTRASOUND_ECHO_PIN PB0         //The echo pin, ICP1 (pin 8) timestamps the edges
+#define ULTRASOUND_TRIGGER_COUNTS 3     //The trigger pulse length in timer 1 counts of 4us
+#define ULTRASOUND_TIMEOUT_COUNTS 6250  //The time after the trigger pulse in timer 1 counts before an echo is given up, 25ms is beyond the 4m range
+#define ULTRASOUND_CM_SCALE 4520UL      //Centimeter per timer 1 count times 65536, 4us / 58us per cm
+#define ULTRASOUND_BURST 5              //The amount of pings per measurement, the distance is their median
+#define ULTRASOUND_GAP_COUNTS 2500      //The wait between the end of an echo and the next ping in timer 1 counts, 10ms
+#define ULTRASOUND_LOST_GAP_COUNTS 8750 //The wait after a timeout in timer 1 counts, 35ms, without an echo the HC-SR04 holds it high for 38ms and ignores pings, the next ping follows 60ms after the trigger
+#define ULTRASOUND_MIN_COUNTS 29        //The shortest accepted echo in timer 1 counts, 2cm
+#define ULTRASOUND_MAX_COUNTS 5800      //The longest accepted echo in timer 1 counts, 400cm
+#define ULTRASOUND_AGREE_COUNTS 29      //The largest difference with the median of an agreeing ping in timer 1 counts, 2cm
+
+void setup_ultrasound(unsigned char readyTask); //Set up the ultrasound sensor, the scheduler event task is signaled when a measurement ends
+void trigger_ultrasonor();      //Start a burst of pings, does nothing while a measurement is running
+unsigned char get_distance(fixed_t* distance); //Write the median distance in centimeter of the last burst, returns the confidence in percent, 0 when no ping had a valid echo
+
+#endif
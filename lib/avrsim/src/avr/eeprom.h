@@ -0,0 +1,35 @@
+#ifndef AVRSIM_EEPROM_H
+#define AVRSIM_EEPROM_H
+
+// Simulated 1 KB EEPROM, pointers are EEPROM addresses like on the target. The routines
+// wait for the running write and take 3.4 ms per written byte.
+
+#include <stdint.h>
+#include <stddef.h>
+#include "avr/io.h"
+
+#define EEMEM
+
+uint8_t eeprom_read_byte(const uint8_t *address);
+uint16_t eeprom_read_word(const uint16_t *address);
+uint32_t eeprom_read_dword(const uint32_t *address);
+float eeprom_read_float(const float *address);
+void eeprom_read_block(void *dest, const void *src, size_t size);
+
+void eeprom_write_byte(uint8_t *address, uint8_t value);
+void eeprom_write_word(uint16_t *address, uint16_t value);
+void eeprom_write_dword(uint32_t *address, uint32_t value);
+void eeprom_write_float(float *address, float value);
+void eeprom_write_block(const void *src, void *dest, size_t size);
+
+void eeprom_update_byte(uint8_t *address, uint8_t value);
+void eeprom_update_word(uint16_t *address, uint16_t value);
+void eeprom_update_dword(uint32_t *address, uint32_t value);
+void eeprom_update_float(float *address, float value);
+void eeprom_update_block(const void *src, void *dest, size_t size);
+
+void eeprom_busy_wait(void);
+
+#define eeprom_is_ready() bit_is_clear(EECR, EEPE)
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef AVRSIM_INTERRUPT_H
+#define AVRSIM_INTERRUPT_H
+
+// Interrupt service routines are plain functions called by the simulator
+
+#include "avr/io.h"
+
+#define ISR(vector, ...) void vector(void)
+
+#define sei() (SREG |= _BV(SREG_I))
+#define cli() (SREG &= ~_BV(SREG_I))
+
+void INT0_vect(void);
+void INT1_vect(void);
+void TIMER2_COMPA_vect(void);
+void TIMER2_COMPB_vect(void);
+void TIMER2_OVF_vect(void);
+void TIMER1_CAPT_vect(void);
+void TIMER1_COMPA_vect(void);
+void TIMER1_COMPB_vect(void);
+void TIMER1_OVF_vect(void);
+void TIMER0_COMPA_vect(void);
+void TIMER0_COMPB_vect(void);
+void TIMER0_OVF_vect(void);
+void USART_RX_vect(void);
+void USART_UDRE_vect(void);
+void USART_TX_vect(void);
+void ADC_vect(void);
+void EE_READY_vect(void);
+
+#endif
@@ -0,0 +1,307 @@
+#ifndef AVRSIM_IO_H
+#define AVRSIM_IO_H
+
+// Simulated ATmega328P registers. Plain registers are variables, registers with
+// side effects (timers, ADC, UART data) are accessed through the simulator.
+
+#include <stdint.h>
+
+#ifndef F_CPU
+#define F_CPU 16000000UL
+#endif
+
+#define _BV(bit) (1 << (bit))
+#define bit_is_set(sfr, bit) ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit) (!((sfr) & _BV(bit)))
+#define loop_until_bit_is_set(sfr, bit) do { } while (bit_is_clear(sfr, bit))
+#define loop_until_bit_is_clear(sfr, bit) do { } while (bit_is_set(sfr, bit))
+
+// GPIO
+extern volatile uint8_t PINB, DDRB, PORTB;
+extern volatile uint8_t PINC, DDRC, PORTC;
+extern volatile uint8_t PIND, DDRD, PORTD;
+
+// External interrupts
+extern volatile uint8_t EICRA, EIMSK, EIFR;
+
+// Sleep and power
+extern volatile uint8_t SMCR, MCUCR, PRR;
+
+// USART0, UDR0 is 16 bits wide so the simulator can see whether it was written, UCSR0A
+// like TIFR0 so it can see which flags were written to clear them
+extern volatile uint8_t UCSR0B, UCSR0C, UBRR0H, UBRR0L;
+extern volatile uint16_t UCSR0A, UDR0;
+
+// ADC
+extern volatile uint8_t ADMUX, ADCSRB, DIDR0;
+extern volatile uint16_t ADC;
+volatile uint8_t *avrsim_adcsra(void);
+#define ADCSRA (*avrsim_adcsra())
+
+// Timer 0, TIFR0 is 16 bits wide so the simulator can see which flags were written to clear them
+extern volatile uint8_t TCCR0A, OCR0A, OCR0B, TIMSK0;
+extern volatile uint16_t TIFR0;
+volatile uint8_t *avrsim_tccr0b(void);
+volatile uint8_t *avrsim_tcnt0(void);
+#define TCCR0B (*avrsim_tccr0b())
+#define TCNT0 (*avrsim_tcnt0())
+
+// Timer 1, TIFR1 is 16 bits wide like TIFR0
+extern volatile uint8_t TCCR1A, TCCR1C, TIMSK1;
+extern volatile uint16_t TIFR1;
+extern volatile uint16_t OCR1A, OCR1B, ICR1;
+volatile uint8_t *avrsim_tccr1b(void);
+volatile uint16_t *avrsim_tcnt1(void);
+#define TCCR1B (*avrsim_tccr1b())
+#define TCNT1 (*avrsim_tcnt1())
+
+// Timer 2
+extern volatile uint8_t TCCR2A, OCR2A, OCR2B, TIMSK2, TIFR2;
+volatile uint8_t *avrsim_tccr2b(void);
+volatile uint8_t *avrsim_tcnt2(void);
+#define TCCR2B (*avrsim_tccr2b())
+#define TCNT2 (*avrsim_tcnt2())
+
+// EEPROM
+extern volatile uint16_t EEAR;
+volatile uint8_t *avrsim_eecr(void);
+volatile uint8_t *avrsim_eedr(void);
+#define EECR (*avrsim_eecr())
+#define EEDR (*avrsim_eedr())
+
+// Status register
+extern volatile uint8_t SREG;
+#define SREG_I 7
+
+// Port bits
+#define PORTB0 0
+#define PORTB1 1
+#define PORTB2 2
+#define PORTB3 3
+#define PORTB4 4
+#define PORTB5 5
+#define PORTB6 6
+#define PORTB7 7
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PINB0 0
+#define PINB1 1
+#define PINB2 2
+#define PINB3 3
+#define PINB4 4
+#define PINB5 5
+#define PINB6 6
+#define PINB7 7
+#define DDB0 0
+#define DDB1 1
+#define DDB2 2
+#define DDB3 3
+#define DDB4 4
+#define DDB5 5
+#define DDB6 6
+#define DDB7 7
+#define PORTC0 0
+#define PORTC1 1
+#define PORTC2 2
+#define PORTC3 3
+#define PORTC4 4
+#define PORTC5 5
+#define PORTC6 6
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+#define PORTD0 0
+#define PORTD1 1
+#define PORTD2 2
+#define PORTD3 3
+#define PORTD4 4
+#define PORTD5 5
+#define PORTD6 6
+#define PORTD7 7
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+#define PIND0 0
+#define PIND1 1
+#define PIND2 2
+#define PIND3 3
+#define PIND4 4
+#define PIND5 5
+#define PIND6 6
+#define PIND7 7
+#define DDD0 0
+#define DDD1 1
+#define DDD2 2
+#define DDD3 3
+#define DDD4 4
+#define DDD5 5
+#define DDD6 6
+#define DDD7 7
+
+// External interrupt bits
+#define ISC00 0
+#define ISC01 1
+#define ISC10 2
+#define ISC11 3
+#define INT0 0
+#define INT1 1
+#define INTF0 0
+#define INTF1 1
+
+// Sleep and power bits
+#define SE 0
+#define SM0 1
+#define SM1 2
+#define SM2 3
+#define PRADC 0
+#define PRUSART0 1
+#define PRSPI 2
+#define PRTIM1 3
+#define PRTIM0 5
+#define PRTIM2 6
+#define PRTWI 7
+
+// USART0 bits
+#define MPCM0 0
+#define U2X0 1
+#define UPE0 2
+#define DOR0 3
+#define FE0 4
+#define UDRE0 5
+#define TXC0 6
+#define RXC0 7
+#define TXB80 0
+#define RXB80 1
+#define UCSZ02 2
+#define TXEN0 3
+#define RXEN0 4
+#define UDRIE0 5
+#define TXCIE0 6
+#define RXCIE0 7
+#define UCPOL0 0
+#define UCSZ00 1
+#define UCSZ01 2
+#define USBS0 3
+#define UPM00 4
+#define UPM01 5
+#define UMSEL00 6
+#define UMSEL01 7
+
+// ADC bits
+#define MUX0 0
+#define MUX1 1
+#define MUX2 2
+#define MUX3 3
+#define ADLAR 5
+#define REFS0 6
+#define REFS1 7
+#define ADPS0 0
+#define ADPS1 1
+#define ADPS2 2
+#define ADIE 3
+#define ADIF 4
+#define ADATE 5
+#define ADSC 6
+#define ADEN 7
+#define ADTS0 0
+#define ADTS1 1
+#define ADTS2 2
+#define ACME 6
+#define ADC0D 0
+#define ADC1D 1
+#define ADC2D 2
+#define ADC3D 3
+#define ADC4D 4
+#define ADC5D 5
+
+// Timer 0 bits
+#define WGM00 0
+#define WGM01 1
+#define COM0B0 4
+#define COM0B1 5
+#define COM0A0 6
+#define COM0A1 7
+#define CS00 0
+#define CS01 1
+#define CS02 2
+#define WGM02 3
+#define FOC0B 6
+#define FOC0A 7
+#define TOIE0 0
+#define OCIE0A 1
+#define OCIE0B 2
+#define TOV0 0
+#define OCF0A 1
+#define OCF0B 2
+
+// Timer 1 bits
+#define WGM10 0
+#define WGM11 1
+#define COM1B0 4
+#define COM1B1 5
+#define COM1A0 6
+#define COM1A1 7
+#define CS10 0
+#define CS11 1
+#define CS12 2
+#define WGM12 3
+#define WGM13 4
+#define ICES1 6
+#define ICNC1 7
+#define FOC1B 6
+#define FOC1A 7
+#define TOIE1 0
+#define OCIE1A 1
+#define OCIE1B 2
+#define ICIE1 5
+#define TOV1 0
+#define OCF1A 1
+#define OCF1B 2
+#define ICF1 5
+
+// Timer 2 bits
+#define WGM20 0
+#define WGM21 1
+#define COM2B0 4
+#define COM2B1 5
+#define COM2A0 6
+#define COM2A1 7
+#define CS20 0
+#define CS21 1
+#define CS22 2
+#define WGM22 3
+#define FOC2B 6
+#define FOC2A 7
+#define TOIE2 0
+#define OCIE2A 1
+#define OCIE2B 2
+#define TOV2 0
+#define OCF2A 1
+#define OCF2B 2
+
+// EEPROM bits
+#define EERE 0
+#define EEPE 1
+#define EEMPE 2
+#define EERIE 3
+#define EEPM0 4
+#define EEPM1 5
+
+#define E2END 0x3FF // Last EEPROM address
+
+#endif
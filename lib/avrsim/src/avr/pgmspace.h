@@ -0,0 +1,21 @@
+#ifndef AVRSIM_PGMSPACE_H
+#define AVRSIM_PGMSPACE_H
+
+// The host has a single address space, program memory reads are plain reads
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+
+#define pgm_read_byte(address) (*(const uint8_t *)(address))
+#define pgm_read_word(address) (*(const uint16_t *)(address))
+#define pgm_read_dword(address) (*(const uint32_t *)(address))
+#define pgm_read_float(address) (*(const float *)(address))
+#define pgm_read_ptr(address) (*(void * const *)(address))
+
+#define memcpy_P memcpy
+#define strlen_P strlen
+
+#endif
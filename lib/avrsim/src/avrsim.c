@@ -0,0 +1,1259 @@
+/*------------------------------------------------------------------*-
+
+  avrsim.c
+
+  Simulated ATmega328P peripherals for running the firmware on the
+  host.  Code runs in zero simulated time; the simulator advances
+  the clock from one interrupt to the next whenever the firmware
+  sleeps (sleep_cpu() calls avrsim_idle()), so the control loop runs
+  far faster than real time and every run is deterministic.
+
+  Simulated hardware:
+
+  Timer 0/1/2  - counters, compare matches and overflows
+  USART0       - 8N1 at the programmed UBRR0 rate
+  ADC          - light sensor (ADC1), TMP36 (ADC0), bandgap, polled
+                 or auto-triggered by the timer 0 compare match A
+  EEPROM       - 1 KB, optionally persisted to a file, writes take
+                 3.4 ms and raise EE_READY when they end
+  Ultrasound   - HC-SR04 with the trigger on OC1B (PB2) and the echo
+                 on ICP1 (PB0), measuring a blind that moves while
+                 the firmware drives it
+  RS-485       - on a bus socket the transceiver's driver enable is
+                 PD2, bytes sent while it is low do not reach the bus
+
+  Environment variables:
+
+  AVRSIM_SECONDS   - simulated run time, 0 runs forever (default 60)
+  AVRSIM_REALTIME  - 1 paces the simulation to the wall clock
+  AVRSIM_UART      - "pty" for a pseudo-terminal, a device/file path,
+                     the unix socket of a bus (see tools/avrbus.c),
+                     or unset for stdin/stdout
+  AVRSIM_EEPROM    - file that holds the EEPROM contents
+  AVRSIM_DAY       - length of the simulated light/temperature cycle
+                     in seconds (default 120)
+  AVRSIM_LIGHT     - fixed light sensor reading (0-1023)
+  AVRSIM_TEMP      - fixed temperature in degrees Celsius
+  AVRSIM_NOISE     - peak noise on the sensor readings in ADC steps
+  AVRSIM_ECHO_ERRORS - share of pings (0-1) answered by a spurious
+                     reflection at a random distance
+  AVRSIM_ECHO_LOST - share of pings (0-1) without any echo, the
+                     sensor then holds the echo high for 38 ms
+  AVRSIM_TRACE     - 1 prints LED and blind changes to stderr
+
+  Unit tests detach the uart from AVRSIM_UART with
+  avrsim_uart_capture(), queue its input with avrsim_uart_receive()
+  and take its output with avrsim_uart_sent().
+
+-*------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+#include "avrsim.h"
+#include "avr/io.h"
+#include "avr/interrupt.h"
+#include "avr/eeprom.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#define CYCLES_PER_US (F_CPU / 1000000UL)
+#define EEPROM_SIZE (E2END + 1)
+#define RX_QUEUE_SIZE 4096
+#define TX_CAPTURE_SIZE 4096
+
+// Registers without side effects
+volatile uint8_t PINB, DDRB, PORTB;
+volatile uint8_t PINC, DDRC, PORTC;
+volatile uint8_t PIND, DDRD, PORTD;
+volatile uint8_t EICRA, EIMSK, EIFR;
+volatile uint8_t SMCR, MCUCR, PRR;
+volatile uint8_t UCSR0B, UCSR0C = _BV(UCSZ01) | _BV(UCSZ00), UBRR0H, UBRR0L;
+volatile uint16_t UCSR0A = 0x100 | _BV(UDRE0);
+volatile uint16_t UDR0;
+volatile uint8_t ADMUX, ADCSRB, DIDR0;
+volatile uint16_t ADC;
+volatile uint8_t TCCR0A, OCR0A, OCR0B, TIMSK0;
+volatile uint16_t TIFR0 = 0x100;
+volatile uint8_t TCCR1A, TCCR1C, TIMSK1;
+volatile uint16_t TIFR1 = 0x100;
+volatile uint16_t OCR1A, OCR1B, ICR1;
+volatile uint8_t TCCR2A, OCR2A, OCR2B, TIMSK2, TIFR2;
+volatile uint16_t EEAR;
+volatile uint8_t SREG;
+
+// Registers with side effects, accessed through the functions below
+static volatile uint8_t adcsra;
+static volatile uint8_t tccr0b;
+static volatile uint8_t tcnt0;
+static volatile uint8_t tccr1b;
+static volatile uint16_t tcnt1;
+static volatile uint8_t tccr2b;
+static volatile uint8_t tcnt2;
+static volatile uint8_t eecr;
+static volatile uint8_t eedr;
+
+// Default interrupt vectors, the firmware overrides the ones it uses
+__attribute__((weak)) void INT0_vect(void) {}
+__attribute__((weak)) void INT1_vect(void) {}
+__attribute__((weak)) void TIMER2_COMPA_vect(void) {}
+__attribute__((weak)) void TIMER2_COMPB_vect(void) {}
+__attribute__((weak)) void TIMER2_OVF_vect(void) {}
+__attribute__((weak)) void TIMER1_CAPT_vect(void) {}
+__attribute__((weak)) void TIMER1_COMPA_vect(void) {}
+__attribute__((weak)) void TIMER1_COMPB_vect(void) {}
+__attribute__((weak)) void TIMER1_OVF_vect(void) {}
+__attribute__((weak)) void TIMER0_COMPA_vect(void) {}
+__attribute__((weak)) void TIMER0_COMPB_vect(void) {}
+__attribute__((weak)) void TIMER0_OVF_vect(void) {}
+__attribute__((weak)) void USART_RX_vect(void) {}
+__attribute__((weak)) void USART_UDRE_vect(void) {}
+__attribute__((weak)) void USART_TX_vect(void) {}
+__attribute__((weak)) void ADC_vect(void) {}
+__attribute__((weak)) void EE_READY_vect(void) {}
+
+typedef enum {
+    EV_NONE,
+    EV_T0_COMPA,
+    EV_T1_COMPA,
+    EV_T1_COMPB,
+    EV_T1_OVF,
+    EV_T1_CAPT_INT,
+    EV_T2_OVF,
+    EV_ADC_DONE,
+    EV_ADC_INT,
+    EV_UART_RX,
+    EV_UART_UDRE,
+    EV_UART_TXC,
+    EV_EE_READY,
+    EV_ECHO_RISE,
+    EV_ECHO_FALL
+} Event;
+
+static const unsigned int timer01_prescalers[8] = {0, 1, 8, 64, 256, 1024, 0, 0};
+static const unsigned int timer2_prescalers[8] = {0, 1, 8, 32, 64, 128, 256, 1024};
+static const unsigned int adc_prescalers[8] = {2, 2, 4, 8, 16, 32, 64, 128};
+
+static int initialized = 0;
+static uint64_t now = 0;                // Simulated time in cycles
+static uint64_t end = 0;                // End of the simulation, 0 runs forever
+static int realtime = 0;
+static int trace = 0;
+static struct timespec wall_start;
+
+// Timers
+static uint8_t tifr0 = 0;               // Timer 0 flags, TIFR0 shows them with bit 8 set until the firmware writes it
+static uint64_t t0_synced = 0;
+static uint8_t tifr1 = 0;               // Timer 1 flags, only ICF1 is modeled
+static uint64_t t1_synced = 0;
+static int oc1b = 0;                    // Level of the OC1B output
+static uint64_t oc1b_rise = 0;          // Time OC1B went high
+static uint64_t t2_synced = 0;
+
+// ADC
+static int adc_busy = 0;                // An auto-triggered conversion is running
+static uint8_t adc_mux = 0;             // The multiplexer setting latched at the start of the conversion
+static uint64_t adc_done = 0;           // End of the running conversion
+
+// USART
+static int uart_in = -1;
+static int uart_out = -1;
+static int uart_bus = 0;                // Set when the uart is on a bus, the RS-485 driver is enabled by PD2
+static uint8_t rx_queue[RX_QUEUE_SIZE];
+static unsigned int rx_head = 0, rx_tail = 0;
+static uint64_t rx_available = 0;       // Time the queued input became available
+static uint64_t rx_done = 0;            // End of the last received byte
+static uint64_t tx_free = 0;            // End of the last transmitted byte
+static uint8_t ucsr0a = _BV(UDRE0);     // USART flags, UCSR0A shows them with bit 8 set until the firmware writes it
+static int tx_shifting = 0;             // A byte is being sent, TXC0 is set when it ends and no byte follows
+static uint64_t uart_traced = 0;        // The byte time of the last traced rate
+static int uart_captured = 0;           // Set when a unit test drives the uart
+static uint8_t tx_captured[TX_CAPTURE_SIZE];    // The bytes a captured uart sent
+static size_t tx_captured_size = 0;
+
+// EEPROM
+static uint8_t eeprom[EEPROM_SIZE];
+static const char *eeprom_file = NULL;
+static int eeprom_armed = 0;            // EEMPE was seen set, the next access may start a write
+static int eeprom_busy = 0;             // A write is running, EEPE stays set until it ends
+static uint64_t eeprom_done = 0;        // End of the running write
+
+// Environment
+static double day_seconds = 120.0;
+static int light_fixed = -1;
+static double temp_fixed = -1000.0;
+static double adc_noise = 0;
+static unsigned int noise_seed = 1;     // Fixed seed, every run sees the same noise
+static double echo_errors = 0;
+static double echo_lost = 0;
+static unsigned int echo_seed = 1;
+static double blind = 10.0;             // Distance from the sensor to the blind in cm
+static uint64_t blind_updated = 0;
+static uint64_t yellow_changed = 0;
+static uint8_t last_portb = 0;
+static uint64_t echo_rise = 0, echo_fall = 0;
+
+static void blind_update(void);
+static void init(void);
+static void run_until(uint64_t t);
+
+// Statistics
+static unsigned long stat_ticks = 0, stat_interrupts = 0, stat_rx = 0, stat_tx = 0;
+
+static double seconds(uint64_t cycles)
+{
+    return (double) cycles / F_CPU;
+}
+
+/*------------------------------------------------------------------*-
+  Environment model
+-*------------------------------------------------------------------*/
+
+// Triangle wave between 0 and 1 over the simulated day
+static double day_phase(void)
+{
+    double x = seconds(now) / day_seconds;
+    x -= (long) x;
+    return x < 0.5 ? x * 2 : 2 - x * 2;
+}
+
+static double light_level(void)
+{
+    return light_fixed >= 0 ? light_fixed : 100 + 800 * day_phase();
+}
+
+static double temperature(void)
+{
+    return temp_fixed > -1000.0 ? temp_fixed : 15 + 15 * day_phase();
+}
+
+// ADC reading of a multiplexer channel with a 5 V reference
+static uint16_t adc_sample(uint8_t mux)
+{
+    double volts = 0;
+
+    switch (mux & 0x0F) {
+        case 0: volts = 0.5 + temperature() / 100.0; break;   // TMP36
+        case 1: volts = light_level() * 5.0 / 1024; break;    // Light sensor divider
+        case 14: volts = 1.1; break;                          // Bandgap reference
+        default: break;
+    }
+
+    double value = volts * 1024 / 5.0;
+    if (adc_noise > 0 && (mux & 0x0F) < 8) {
+        value += adc_noise * (2.0 * rand_r(&noise_seed) / RAND_MAX - 1.0);
+    }
+    return value < 0 ? 0 : value > 1023 ? 1023 : (uint16_t) value;
+}
+
+// Move the blind while the firmware is transitioning (the yellow LED blinks)
+static void blind_update(void)
+{
+    uint8_t portb = PORTB;
+    double dt = seconds(now - blind_updated);
+    int moving = (now - yellow_changed) < (uint64_t) (0.75 * F_CPU);
+
+    if ((portb ^ last_portb) & _BV(PB5)) {
+        yellow_changed = now;
+    }
+
+    if (moving && (portb & _BV(PB4)) && !(portb & _BV(PB3))) {
+        blind += 10.0 * dt;     // Rolling down
+    }
+    else if (moving && (portb & _BV(PB3)) && !(portb & _BV(PB4))) {
+        blind -= 10.0 * dt;     // Rolling up
+    }
+    if (blind < 3) blind = 3;
+    if (blind > 80) blind = 80;
+    blind_updated = now;
+
+    if (trace && ((portb ^ last_portb) & (_BV(PB3) | _BV(PB4)))) {
+        fprintf(stderr, "[%9.3f] red %d green %d blind %.1f cm light %.0f temp %.1f\n", seconds(now),
+                !!(portb & _BV(PB3)), !!(portb & _BV(PB4)), blind, light_level(), temperature());
+    }
+    last_portb = portb;
+}
+
+/*------------------------------------------------------------------*-
+  Timers
+-*------------------------------------------------------------------*/
+
+static int timer0_ctc(void)
+{
+    return (TCCR0A & (_BV(WGM01) | _BV(WGM00))) == _BV(WGM01) && !(tccr0b & _BV(WGM02));
+}
+
+static unsigned int timer0_prescaler(void)
+{
+    return (PRR & _BV(PRTIM0)) ? 0 : timer01_prescalers[tccr0b & 7];
+}
+
+// Bring TCNT0 up to date with the simulated time
+static void timer0_sync(void)
+{
+    unsigned int p = timer0_prescaler();
+
+    if (p) {
+        uint64_t ticks = now / p - t0_synced / p;
+        uint32_t c = tcnt0;
+        uint32_t top = timer0_ctc() ? OCR0A : 0xFF;
+
+        if (c > top) {
+            // Above the compare value in CTC mode, count up to MAX first
+            if (ticks < 0x100 - c) {
+                c += ticks;
+                ticks = 0;
+            }
+            else {
+                ticks -= 0x100 - c;
+                c = 0;
+            }
+        }
+        tcnt0 = (uint8_t) (c <= top ? (c + ticks) % (top + 1) : c);
+    }
+    t0_synced = now;
+}
+
+// Ticks until TCNT0 next becomes the given value, 0 when it never does
+static uint32_t timer0_ticks_until(uint8_t value)
+{
+    uint32_t c = tcnt0;
+
+    if (timer0_ctc()) {
+        uint32_t period = (uint32_t) OCR0A + 1;
+        if (c <= OCR0A) {
+            if (value > OCR0A) {
+                return 0;
+            }
+            uint32_t k = (value + period - c) % period;
+            return k ? k : period;
+        }
+        return value > c ? value - c : 0x100 - c + value;
+    }
+
+    uint32_t k = (uint8_t) (value - c);
+    return k ? k : 0x100;
+}
+
+// Apply the flags the firmware cleared by writing a one to them
+static void tifr0_sync(void)
+{
+    if (!(TIFR0 & 0x100)) {
+        tifr0 &= ~TIFR0;
+    }
+    TIFR0 = 0x100 | tifr0;
+}
+
+static int timer1_ctc(void)
+{
+    return (tccr1b & (_BV(WGM13) | _BV(WGM12))) == _BV(WGM12);
+}
+
+static unsigned int timer1_prescaler(void)
+{
+    return (PRR & _BV(PRTIM1)) ? 0 : timer01_prescalers[tccr1b & 7];
+}
+
+static unsigned int timer2_prescaler(void)
+{
+    return (PRR & _BV(PRTIM2)) ? 0 : timer2_prescalers[tccr2b & 7];
+}
+
+// COM1B mode, 1 toggles, 2 clears and 3 sets OC1B on a compare match
+static int oc1b_mode(void)
+{
+    return (TCCR1A >> COM1B0) & 3;
+}
+
+// Apply a compare match to OC1B, the sensor starts a measurement on the falling edge of a 10 us pulse
+static void oc1b_compare(void)
+{
+    int level = oc1b;
+
+    switch (oc1b_mode()) {
+        case 1: level = !oc1b; break;
+        case 2: level = 0; break;
+        case 3: level = 1; break;
+        default: return;
+    }
+
+    if (level && !oc1b) {
+        oc1b_rise = now;
+    }
+    else if (!level && oc1b && (DDRB & _BV(DDB2)) && now - oc1b_rise >= 10 * CYCLES_PER_US
+             && !echo_rise && !echo_fall) {
+        double distance;
+
+        blind_update();
+        distance = blind;
+        if (echo_errors > 0 && rand_r(&echo_seed) < echo_errors * RAND_MAX) {
+            distance = 2 + rand_r(&echo_seed) % 300;
+        }
+        echo_rise = now + 460 * CYCLES_PER_US;
+        echo_fall = echo_rise + (uint64_t) (distance * 58 * CYCLES_PER_US);
+        if (echo_lost > 0 && rand_r(&echo_seed) < echo_lost * RAND_MAX) {
+            // No echo came back, the sensor gives up after 38 ms
+            echo_fall = echo_rise + 38000 * CYCLES_PER_US;
+        }
+    }
+    oc1b = level;
+}
+
+// Apply the flags the firmware cleared by writing a one to them
+static void tifr1_sync(void)
+{
+    if (!(TIFR1 & 0x100)) {
+        tifr1 &= ~TIFR1;
+    }
+    TIFR1 = 0x100 | tifr1;
+}
+
+// Bring TCNT1 up to date with the simulated time
+static void timer1_sync(void)
+{
+    unsigned int p = timer1_prescaler();
+
+    if (p) {
+        uint64_t ticks = now / p - t1_synced / p;
+        uint32_t c = tcnt1;
+        uint32_t top = timer1_ctc() ? OCR1A : 0xFFFF;
+
+        if (c > top) {
+            // Above the compare value in CTC mode, count up to MAX first
+            if (ticks < 0x10000 - c) {
+                c += ticks;
+                ticks = 0;
+            }
+            else {
+                ticks -= 0x10000 - c;
+                c = 0;
+            }
+        }
+        tcnt1 = (uint16_t) (c <= top ? (c + ticks) % (top + 1) : c);
+    }
+    t1_synced = now;
+
+    // FOC1B is a strobe that applies a compare match right away
+    if (TCCR1C & _BV(FOC1B)) {
+        TCCR1C &= ~_BV(FOC1B);
+        oc1b_compare();
+    }
+}
+
+static void timer2_sync(void)
+{
+    unsigned int p = timer2_prescaler();
+
+    if (p) {
+        tcnt2 = (uint8_t) (tcnt2 + now / p - t2_synced / p);
+    }
+    t2_synced = now;
+}
+
+// Ticks until TCNT1 next becomes the given value, 0 when it never does
+static uint32_t timer1_ticks_until(uint16_t value)
+{
+    uint32_t c = tcnt1;
+
+    if (timer1_ctc()) {
+        uint32_t period = (uint32_t) OCR1A + 1;
+        if (c <= OCR1A) {
+            if (value > OCR1A) {
+                return 0;
+            }
+            uint32_t k = (value + period - c) % period;
+            return k ? k : period;
+        }
+        return value > c ? value - c : 0x10000 - c + value;
+    }
+
+    uint32_t k = (uint16_t) (value - c);
+    return k ? k : 0x10000;
+}
+
+// Time of the prescaled tick that is the given amount of ticks away
+static uint64_t tick_time(unsigned int prescaler, uint32_t ticks)
+{
+    return (now / prescaler + ticks) * prescaler;
+}
+
+volatile uint8_t *avrsim_tccr0b(void)
+{
+    timer0_sync();
+    return &tccr0b;
+}
+
+volatile uint8_t *avrsim_tcnt0(void)
+{
+    timer0_sync();
+    return &tcnt0;
+}
+
+volatile uint8_t *avrsim_tccr1b(void)
+{
+    timer1_sync();
+    return &tccr1b;
+}
+
+volatile uint16_t *avrsim_tcnt1(void)
+{
+    timer1_sync();
+    return &tcnt1;
+}
+
+volatile uint8_t *avrsim_tccr2b(void)
+{
+    timer2_sync();
+    return &tccr2b;
+}
+
+volatile uint8_t *avrsim_tcnt2(void)
+{
+    timer2_sync();
+    return &tcnt2;
+}
+
+/*------------------------------------------------------------------*-
+  ADC
+-*------------------------------------------------------------------*/
+
+// A conversion started by the firmware has completed by the time it looks again. ADIF is
+// only set by auto-triggered conversions, the firmware clears it of polled ones by writing
+// ADCSRA back, which the simulator cannot see.
+volatile uint8_t *avrsim_adcsra(void)
+{
+    if ((adcsra & _BV(ADEN)) && (adcsra & _BV(ADSC)) && !adc_busy) {
+        ADC = adc_sample(ADMUX);
+        adcsra &= ~_BV(ADSC);
+    }
+    return &adcsra;
+}
+
+// The timer 0 compare match A starts conversions when it is the auto trigger source
+static int adc_timer0_trigger(void)
+{
+    return (adcsra & _BV(ADEN)) && (adcsra & _BV(ADATE)) && (ADCSRB & 7) == (_BV(ADTS1) | _BV(ADTS0));
+}
+
+// Start a conversion, an auto-triggered conversion takes 13.5 ADC clock cycles
+static void adc_start(void)
+{
+    adc_busy = 1;
+    adc_mux = ADMUX;
+    adcsra |= _BV(ADSC);
+    adc_done = now + adc_prescalers[adcsra & 7] * 27 / 2;
+}
+
+/*------------------------------------------------------------------*-
+  USART
+-*------------------------------------------------------------------*/
+
+// Apply a write of the firmware, TXC0 is cleared by writing a one and U2X0 and MPCM0 are
+// plain bits, the other flags are read only
+static void ucsr0a_sync(void)
+{
+    if (!(UCSR0A & 0x100)) {
+        ucsr0a &= ~(UCSR0A & _BV(TXC0));
+        ucsr0a = (ucsr0a & ~(_BV(U2X0) | _BV(MPCM0))) | (UCSR0A & (_BV(U2X0) | _BV(MPCM0)));
+    }
+    UCSR0A = 0x100 | ucsr0a;
+}
+
+static uint64_t uart_byte_cycles(void)
+{
+    uint32_t ubrr = ((UBRR0H & 0x0F) << 8) | UBRR0L;
+    uint32_t divider = (ucsr0a & _BV(U2X0)) ? 8 : 16;
+    return 10ULL * divider * (ubrr + 1);
+}
+
+// Print the rate when the firmware changed it
+static void uart_trace(void)
+{
+    uint64_t cycles = uart_byte_cycles();
+
+    if (trace && cycles != uart_traced) {
+        fprintf(stderr, "[%9.3f] uart %.0f baud\n", seconds(now), 10.0 * F_CPU / cycles);
+    }
+    uart_traced = cycles;
+}
+
+// Queue bytes on the input, they arrive one byte time after the other
+static void uart_queue(const uint8_t *data, size_t size)
+{
+    if (rx_head == rx_tail) {
+        rx_available = now;
+    }
+    for (size_t i = 0; i < size; i++) {
+        unsigned int next = (rx_head + 1) % RX_QUEUE_SIZE;
+        if (next != rx_tail) {
+            rx_queue[rx_head] = data[i];
+            rx_head = next;
+        }
+    }
+}
+
+// Queue the bytes that are waiting on the input
+static void uart_poll(void)
+{
+    uint8_t data[256];
+    ssize_t n;
+
+    if (uart_in < 0) {
+        return;
+    }
+
+    while ((n = read(uart_in, data, sizeof(data))) > 0) {
+        uart_queue(data, (size_t) n);
+    }
+    if (n == 0 && uart_in != uart_out) {
+        // End of the input file, keep running without input
+        uart_in = -1;
+    }
+}
+
+static void uart_open(void)
+{
+    const char *uart = getenv("AVRSIM_UART");
+    struct stat st;
+
+    if (uart_captured) {
+        return;
+    }
+
+    if (uart && strcmp(uart, "pty") == 0) {
+        int fd = posix_openpt(O_RDWR | O_NOCTTY);
+        if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0) {
+            perror("avrsim: pty");
+            exit(1);
+        }
+        fprintf(stderr, "avrsim: uart on %s\n", ptsname(fd));
+        uart_in = uart_out = fd;
+    }
+    else if (uart && *uart && stat(uart, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        strncpy(addr.sun_path, uart, sizeof(addr.sun_path) - 1);
+        if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+            perror("avrsim: bus");
+            exit(1);
+        }
+        uart_in = uart_out = fd;
+        uart_bus = 1;
+    }
+    else if (uart && *uart) {
+        int fd = open(uart, O_RDWR | O_NOCTTY);
+        if (fd < 0) {
+            perror("avrsim: uart");
+            exit(1);
+        }
+        uart_in = uart_out = fd;
+    }
+    else {
+        uart_in = STDIN_FILENO;
+        uart_out = STDOUT_FILENO;
+    }
+    fcntl(uart_in, F_SETFL, fcntl(uart_in, F_GETFL) | O_NONBLOCK);
+}
+
+/*------------------------------------------------------------------*-
+  EEPROM
+-*------------------------------------------------------------------*/
+
+static void eeprom_load(void)
+{
+    memset(eeprom, 0xFF, sizeof(eeprom));
+    eeprom_file = getenv("AVRSIM_EEPROM");
+    if (eeprom_file) {
+        FILE *f = fopen(eeprom_file, "rb");
+        if (f) {
+            if (fread(eeprom, 1, sizeof(eeprom), f) == 0) {
+                memset(eeprom, 0xFF, sizeof(eeprom));
+            }
+            fclose(f);
+        }
+    }
+}
+
+static void eeprom_save(void)
+{
+    if (eeprom_file) {
+        FILE *f = fopen(eeprom_file, "wb");
+        if (f) {
+            fwrite(eeprom, 1, sizeof(eeprom), f);
+            fclose(f);
+        }
+    }
+}
+
+// Write times of the programming modes selected by EEPM1:0, erase and write, erase only, write only
+static const double eeprom_write_us[4] = {3400, 1800, 1800, 0};
+
+// Start a write of one byte, the byte is stored right away since the firmware may not read it
+// before EEPE clears
+static void eeprom_start(uint16_t address, uint8_t value, unsigned int mode)
+{
+    uint8_t *cell = &eeprom[address & E2END];
+
+    *cell = mode == 1 ? 0xFF : mode == 2 ? (*cell & value) : value;
+    eeprom_busy = 1;
+    eeprom_done = now + (uint64_t) (eeprom_write_us[mode] * CYCLES_PER_US);
+    eecr |= _BV(EEPE);
+}
+
+// Act on the bits the firmware set since the last access. EEMPE expires at the access after
+// the one that saw it, so only the usual EEMPE then EEPE sequence starts a write.
+static void eeprom_sync(void)
+{
+    if (eeprom_busy && now >= eeprom_done) {
+        eeprom_busy = 0;
+        eecr &= ~_BV(EEPE);
+    }
+    if (eeprom_busy) {
+        // The hardware ignores reads and writes until the running write ends
+        eecr &= ~(_BV(EERE) | _BV(EEMPE));
+        eeprom_armed = 0;
+        return;
+    }
+
+    if (eecr & _BV(EERE)) {
+        eedr = eeprom[EEAR & E2END];
+        eecr &= ~_BV(EERE);
+    }
+    if (eecr & _BV(EEPE)) {
+        if (eecr & _BV(EEMPE)) {
+            eeprom_start(EEAR, eedr, (eecr >> EEPM0) & 3);
+        }
+        else {
+            eecr &= ~_BV(EEPE);
+        }
+        eecr &= ~_BV(EEMPE);
+        eeprom_armed = 0;
+    }
+    else if (eecr & _BV(EEMPE)) {
+        if (eeprom_armed) {
+            eecr &= ~_BV(EEMPE);
+        }
+        eeprom_armed = !eeprom_armed;
+    }
+}
+
+volatile uint8_t *avrsim_eecr(void)
+{
+    eeprom_sync();
+    return &eecr;
+}
+
+volatile uint8_t *avrsim_eedr(void)
+{
+    eeprom_sync();
+    return &eedr;
+}
+
+// The avr-libc routines wait for a running write before they touch the EEPROM
+static void eeprom_wait(void)
+{
+    eeprom_sync();
+    if (eeprom_busy) {
+        run_until(eeprom_done);
+        eeprom_sync();
+    }
+}
+
+static uint8_t *eeprom_at(const volatile void *address, size_t size)
+{
+    uintptr_t a = (uintptr_t) address;
+
+    // The firmware reads its settings before the first idle call, the file has to be loaded by then
+    if (!initialized) {
+        init();
+    }
+    if (a + size > EEPROM_SIZE) {
+        fprintf(stderr, "avrsim: eeprom access outside 0x%04lx\n", (unsigned long) a);
+        exit(1);
+    }
+    return &eeprom[a];
+}
+
+void eeprom_read_block(void *dest, const void *src, size_t size)
+{
+    uint8_t *cells = eeprom_at(src, size);
+
+    eeprom_wait();
+    memcpy(dest, cells, size);
+}
+
+// Every byte is a separate 3.4 ms write like on the target
+void eeprom_write_block(const void *src, void *dest, size_t size)
+{
+    uint16_t address = (uint16_t) (uintptr_t) dest;
+
+    eeprom_at(dest, size);
+    for (size_t i = 0; i < size; i++) {
+        eeprom_wait();
+        eeprom_start(address + i, ((const uint8_t *) src)[i], 0);
+    }
+}
+
+// Only the bytes that change are written
+void eeprom_update_block(const void *src, void *dest, size_t size)
+{
+    uint8_t *cells = eeprom_at(dest, size);
+
+    for (size_t i = 0; i < size; i++) {
+        eeprom_wait();
+        if (cells[i] != ((const uint8_t *) src)[i]) {
+            eeprom_start((uint16_t) ((uintptr_t) dest + i), ((const uint8_t *) src)[i], 0);
+        }
+    }
+}
+
+uint8_t eeprom_read_byte(const uint8_t *address) { uint8_t v; eeprom_read_block(&v, address, sizeof(v)); return v; }
+uint16_t eeprom_read_word(const uint16_t *address) { uint16_t v; eeprom_read_block(&v, address, sizeof(v)); return v; }
+uint32_t eeprom_read_dword(const uint32_t *address) { uint32_t v; eeprom_read_block(&v, address, sizeof(v)); return v; }
+float eeprom_read_float(const float *address) { float v; eeprom_read_block(&v, address, sizeof(v)); return v; }
+void eeprom_write_byte(uint8_t *address, uint8_t value) { eeprom_write_block(&value, address, sizeof(value)); }
+void eeprom_write_word(uint16_t *address, uint16_t value) { eeprom_write_block(&value, address, sizeof(value)); }
+void eeprom_write_dword(uint32_t *address, uint32_t value) { eeprom_write_block(&value, address, sizeof(value)); }
+void eeprom_write_float(float *address, float value) { eeprom_write_block(&value, address, sizeof(value)); }
+void eeprom_update_byte(uint8_t *address, uint8_t value) { eeprom_update_block(&value, address, sizeof(value)); }
+void eeprom_update_word(uint16_t *address, uint16_t value) { eeprom_update_block(&value, address, sizeof(value)); }
+void eeprom_update_dword(uint32_t *address, uint32_t value) { eeprom_update_block(&value, address, sizeof(value)); }
+void eeprom_update_float(float *address, float value) { eeprom_update_block(&value, address, sizeof(value)); }
+void eeprom_busy_wait(void) { eeprom_wait(); }
+
+/*------------------------------------------------------------------*-
+  Event scheduling
+-*------------------------------------------------------------------*/
+
+static void consider(Event *best, uint64_t *best_at, Event ev, uint64_t at)
+{
+    if (*best == EV_NONE || at < *best_at) {
+        *best = ev;
+        *best_at = at;
+    }
+}
+
+// Find the next event, interrupts that cannot fire are not events
+static Event next_event(uint64_t *at)
+{
+    Event ev = EV_NONE;
+    int enabled = SREG & _BV(SREG_I);
+    unsigned int p;
+    uint32_t k;
+
+    tifr0_sync();
+    tifr1_sync();
+    ucsr0a_sync();
+    uart_trace();
+    eeprom_sync();
+    timer0_sync();
+    timer1_sync();
+    timer2_sync();
+
+    // A compare match matters when it runs the interrupt or raises the flag that triggers the ADC
+    p = timer0_prescaler();
+    if (p && ((enabled && (TIMSK0 & _BV(OCIE0A))) || (adc_timer0_trigger() && !(tifr0 & _BV(OCF0A))))
+        && (k = timer0_ticks_until(OCR0A))) {
+        consider(&ev, at, EV_T0_COMPA, tick_time(p, k));
+    }
+
+    p = timer1_prescaler();
+    if (enabled && p) {
+        if ((TIMSK1 & _BV(OCIE1A)) && (k = timer1_ticks_until(OCR1A))) {
+            consider(&ev, at, EV_T1_COMPA, tick_time(p, k));
+        }
+        if ((TIMSK1 & _BV(OCIE1B)) && (k = timer1_ticks_until(OCR1B))) {
+            consider(&ev, at, EV_T1_COMPB, tick_time(p, k));
+        }
+        if ((TIMSK1 & _BV(ICIE1)) && (tifr1 & _BV(ICF1))) {
+            consider(&ev, at, EV_T1_CAPT_INT, now);
+        }
+    }
+    if (p && !(enabled && (TIMSK1 & _BV(OCIE1B)))) {
+        // The compare match still drives the OC1B pin when its interrupt cannot run
+        int mode = oc1b_mode();
+        if ((mode == 1 || (mode == 2 && oc1b) || (mode == 3 && !oc1b)) && (k = timer1_ticks_until(OCR1B))) {
+            consider(&ev, at, EV_T1_COMPB, tick_time(p, k));
+        }
+        if ((TIMSK1 & _BV(TOIE1)) && (k = timer1_ticks_until(0))) {
+            consider(&ev, at, EV_T1_OVF, tick_time(p, k));
+        }
+    }
+
+    p = timer2_prescaler();
+    if (enabled && p && (TIMSK2 & _BV(TOIE2))) {
+        consider(&ev, at, EV_T2_OVF, tick_time(p, 0x100 - tcnt2));
+    }
+
+    if (adc_busy) {
+        consider(&ev, at, EV_ADC_DONE, adc_done);
+    }
+    if (enabled && (adcsra & _BV(ADIE)) && (adcsra & _BV(ADIF))) {
+        consider(&ev, at, EV_ADC_INT, now);
+    }
+
+    if (rx_head != rx_tail && (UCSR0B & _BV(RXEN0))) {
+        uint64_t start = rx_available > rx_done ? rx_available : rx_done;
+        consider(&ev, at, EV_UART_RX, start + uart_byte_cycles());
+    }
+
+    if (enabled && (UCSR0B & _BV(UDRIE0)) && (UCSR0B & _BV(TXEN0))) {
+        consider(&ev, at, EV_UART_UDRE, tx_free > now ? tx_free : now);
+    }
+    if (tx_shifting) {
+        // Considered after UDRE so a byte written at the end of the last one keeps TXC0 clear
+        consider(&ev, at, EV_UART_TXC, tx_free);
+    }
+    if (enabled && (eecr & _BV(EERIE))) {
+        // EE_READY keeps firing for as long as it is enabled and no write runs
+        consider(&ev, at, EV_EE_READY, eeprom_busy ? eeprom_done : now);
+    }
+
+    if (echo_rise) {
+        consider(&ev, at, EV_ECHO_RISE, echo_rise);
+    }
+    else if (echo_fall) {
+        consider(&ev, at, EV_ECHO_FALL, echo_fall);
+    }
+
+    return ev;
+}
+
+// Run an interrupt service routine with interrupts disabled like the hardware does
+static void interrupt(void (*vector)(void))
+{
+    uint8_t sreg = SREG;
+
+    SREG &= ~_BV(SREG_I);
+    vector();
+    SREG = sreg;
+    stat_interrupts++;
+}
+
+// The echo pin is ICP1, an edge that matches ICES1 captures TCNT1
+static void echo_edge(int high)
+{
+    if (high) {
+        PINB |= _BV(PINB0);
+    }
+    else {
+        PINB &= ~_BV(PINB0);
+    }
+
+    if (!high == !(tccr1b & _BV(ICES1))) {
+        timer1_sync();
+        ICR1 = tcnt1;
+        tifr1 |= _BV(ICF1);
+        if ((TIMSK1 & _BV(ICIE1)) && (SREG & _BV(SREG_I))) {
+            tifr1 &= ~_BV(ICF1);
+            TIFR1 = 0x100 | tifr1;
+            interrupt(TIMER1_CAPT_vect);
+        }
+        tifr1_sync();
+    }
+}
+
+static void fire(Event ev)
+{
+    switch (ev) {
+        case EV_T0_COMPA:
+            if (!(tifr0 & _BV(OCF0A)) && adc_timer0_trigger() && !adc_busy) {
+                adc_start();
+            }
+            tifr0 |= _BV(OCF0A);
+            if ((TIMSK0 & _BV(OCIE0A)) && (SREG & _BV(SREG_I))) {
+                tifr0 &= ~_BV(OCF0A);
+                TIFR0 = 0x100 | tifr0;
+                interrupt(TIMER0_COMPA_vect);
+            }
+            tifr0_sync();
+            break;
+
+        case EV_T1_COMPA:
+            stat_ticks++;
+            interrupt(TIMER1_COMPA_vect);
+            break;
+
+        case EV_T1_COMPB:
+            oc1b_compare();
+            if ((TIMSK1 & _BV(OCIE1B)) && (SREG & _BV(SREG_I))) {
+                interrupt(TIMER1_COMPB_vect);
+            }
+            break;
+
+        case EV_T1_CAPT_INT:
+            tifr1 &= ~_BV(ICF1);
+            TIFR1 = 0x100 | tifr1;
+            interrupt(TIMER1_CAPT_vect);
+            tifr1_sync();
+            break;
+
+        case EV_T1_OVF:
+            interrupt(TIMER1_OVF_vect);
+            break;
+
+        case EV_T2_OVF:
+            interrupt(TIMER2_OVF_vect);
+            break;
+
+        case EV_ADC_DONE:
+            adc_busy = 0;
+            ADC = adc_sample(adc_mux);
+            adcsra = (adcsra & ~_BV(ADSC)) | _BV(ADIF);
+            // Run the interrupt right away when it can
+            /* fall through */
+        case EV_ADC_INT:
+            if ((adcsra & _BV(ADIE)) && (SREG & _BV(SREG_I))) {
+                adcsra &= ~_BV(ADIF);
+                interrupt(ADC_vect);
+                tifr0_sync();
+            }
+            break;
+
+        case EV_UART_RX:
+            UDR0 = rx_queue[rx_tail];
+            rx_tail = (rx_tail + 1) % RX_QUEUE_SIZE;
+            rx_done = now;
+            stat_rx++;
+            if (ucsr0a & _BV(RXC0)) {
+                ucsr0a |= _BV(DOR0);
+            }
+            ucsr0a |= _BV(RXC0);
+            UCSR0A = 0x100 | ucsr0a;
+            if ((UCSR0B & _BV(RXCIE0)) && (SREG & _BV(SREG_I))) {
+                interrupt(USART_RX_vect);
+                ucsr0a_sync();
+                ucsr0a &= ~(_BV(RXC0) | _BV(DOR0));
+                UCSR0A = 0x100 | ucsr0a;
+            }
+            break;
+
+        case EV_UART_UDRE:
+            // UDR0 holds a value above 0xFF until the routine writes a byte
+            UDR0 = 0x100;
+            interrupt(USART_UDRE_vect);
+            if (UDR0 <= 0xFF) {
+                uint8_t data = (uint8_t) UDR0;
+                int driven = !uart_bus || ((DDRD & _BV(PD2)) && (PORTD & _BV(PD2)));
+                if (uart_captured && driven && tx_captured_size < TX_CAPTURE_SIZE) {
+                    tx_captured[tx_captured_size++] = data;
+                }
+                else if (uart_out >= 0 && driven && write(uart_out, &data, 1) < 0) {
+                    uart_out = -1;
+                }
+                tx_free = now + uart_byte_cycles();
+                tx_shifting = 1;
+                stat_tx++;
+            }
+            else if (UCSR0B & _BV(UDRIE0)) {
+                fprintf(stderr, "avrsim: USART_UDRE_vect left the interrupt enabled without sending\n");
+                exit(1);
+            }
+            break;
+
+        case EV_EE_READY:
+            eeprom_sync();
+            interrupt(EE_READY_vect);
+            eeprom_sync();
+            break;
+
+        case EV_UART_TXC:
+            tx_shifting = 0;
+            ucsr0a_sync();
+            ucsr0a |= _BV(TXC0);
+            UCSR0A = 0x100 | ucsr0a;
+            if ((UCSR0B & _BV(TXCIE0)) && (SREG & _BV(SREG_I))) {
+                // Running the interrupt clears the flag
+                ucsr0a &= ~_BV(TXC0);
+                UCSR0A = 0x100 | ucsr0a;
+                interrupt(USART_TX_vect);
+                ucsr0a_sync();
+            }
+            break;
+
+        case EV_ECHO_RISE:
+            echo_rise = 0;
+            echo_edge(1);
+            break;
+
+        case EV_ECHO_FALL:
+            echo_fall = 0;
+            echo_edge(0);
+            break;
+
+        case EV_NONE:
+            break;
+    }
+}
+
+// Process every event up to the given time
+static void run_until(uint64_t t)
+{
+    Event ev;
+    uint64_t at = 0;
+
+    while ((ev = next_event(&at)) != EV_NONE && at <= t) {
+        now = at;
+        fire(ev);
+    }
+    now = t;
+}
+
+/*------------------------------------------------------------------*-
+  Control
+-*------------------------------------------------------------------*/
+
+static void finish(void)
+{
+    struct timespec wall_end;
+    double wall;
+
+    clock_gettime(CLOCK_MONOTONIC, &wall_end);
+    wall = (wall_end.tv_sec - wall_start.tv_sec) + (wall_end.tv_nsec - wall_start.tv_nsec) / 1e9;
+
+    eeprom_save();
+    fprintf(stderr, "avrsim: %.3f s simulated in %.3f s (%.0fx real time), %lu compare matches, %lu interrupts, "
+            "uart rx %lu tx %lu bytes\n", seconds(now), wall, wall > 0 ? seconds(now) / wall : 0,
+            stat_ticks, stat_interrupts, stat_rx, stat_tx);
+}
+
+static void init(void)
+{
+    const char *value;
+
+    initialized = 1;
+    clock_gettime(CLOCK_MONOTONIC, &wall_start);
+
+    value = getenv("AVRSIM_REALTIME");
+    realtime = value && atoi(value);
+    value = getenv("AVRSIM_TRACE");
+    trace = value && atoi(value);
+    value = getenv("AVRSIM_SECONDS");
+    end = (uint64_t) ((value ? atof(value) : (realtime ? 0 : 60)) * F_CPU);
+    value = getenv("AVRSIM_DAY");
+    if (value && atof(value) > 0) day_seconds = atof(value);
+    value = getenv("AVRSIM_LIGHT");
+    if (value) light_fixed = atoi(value);
+    value = getenv("AVRSIM_TEMP");
+    if (value) temp_fixed = atof(value);
+    value = getenv("AVRSIM_NOISE");
+    if (value) adc_noise = atof(value);
+    value = getenv("AVRSIM_ECHO_ERRORS");
+    if (value) echo_errors = atof(value);
+    value = getenv("AVRSIM_ECHO_LOST");
+    if (value) echo_lost = atof(value);
+
+    uart_open();
+    eeprom_load();
+    atexit(finish);
+}
+
+// Wait until the wall clock reaches the simulated time, input ends the wait early
+static void realtime_wait(uint64_t t)
+{
+    struct timespec wall;
+    struct pollfd pfd = {uart_in, POLLIN, 0};
+    double behind;
+
+    clock_gettime(CLOCK_MONOTONIC, &wall);
+    behind = seconds(t) - ((wall.tv_sec - wall_start.tv_sec) + (wall.tv_nsec - wall_start.tv_nsec) / 1e9);
+    if (behind > 0 && poll(&pfd, uart_in >= 0 ? 1 : 0, (int) (behind * 1000)) > 0) {
+        // Input arrived, continue from the current wall time
+        clock_gettime(CLOCK_MONOTONIC, &wall);
+        uint64_t arrived = (uint64_t) (((wall.tv_sec - wall_start.tv_sec) + (wall.tv_nsec - wall_start.tv_nsec) / 1e9) * F_CPU);
+        run_until(arrived > now ? (arrived < t ? arrived : t) : now);
+    }
+}
+
+// Run the next interrupt, called by the main loop when the firmware has nothing to do
+void avrsim_idle(void)
+{
+    Event ev;
+    uint64_t at = 0;
+
+    if (!initialized) {
+        init();
+    }
+
+    blind_update();
+    uart_poll();
+
+    ev = next_event(&at);
+    if (ev == EV_NONE) {
+        // Nothing can wake the processor, let a millisecond pass
+        at = now + CYCLES_PER_US * 1000;
+    }
+
+    if (end && at > end) {
+        run_until(end);
+        exit(0);
+    }
+
+    if (realtime) {
+        realtime_wait(at);
+        uart_poll();
+        ev = next_event(&at);
+        if (ev == EV_NONE) {
+            return;
+        }
+    }
+
+    now = at;
+    fire(ev);
+}
+
+// Busy wait, interrupts keep running
+void avrsim_delay_us(double us)
+{
+    if (!initialized) {
+        init();
+    }
+
+    run_until(now + (uint64_t) (us * CYCLES_PER_US));
+}
+
+uint64_t avrsim_cycles(void)
+{
+    return now;
+}
+
+void avrsim_uart_capture(void)
+{
+    uart_captured = 1;
+    if (!initialized) {
+        init();
+    }
+
+    // Leave stdin and stdout open, the test runner reports on them
+    if (uart_in > STDERR_FILENO) {
+        close(uart_in);
+    }
+    if (uart_out > STDERR_FILENO && uart_out != uart_in) {
+        close(uart_out);
+    }
+    uart_in = uart_out = -1;
+    uart_bus = 0;
+    rx_head = rx_tail = 0;
+    tx_captured_size = 0;
+}
+
+void avrsim_uart_receive(const uint8_t *data, size_t size)
+{
+    uart_queue(data, size);
+}
+
+size_t avrsim_uart_sent(uint8_t *buffer, size_t size)
+{
+    size_t n = tx_captured_size < size ? tx_captured_size : size;
+
+    memcpy(buffer, tx_captured, n);
+    memmove(tx_captured, tx_captured + n, tx_captured_size - n);
+    tx_captured_size -= n;
+    return n;
+}
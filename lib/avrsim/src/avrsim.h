@@ -0,0 +1,18 @@
+#ifndef AVRSIM_H
+#define AVRSIM_H
+
+// Control interface of the simulator, see avrsim.c for the environment variables
+
+#include <stddef.h>
+#include <stdint.h>
+
+void avrsim_idle(void);         // Advance the simulated time to the next interrupt and run it, called by sleep_cpu()
+uint64_t avrsim_cycles(void);   // Returns the simulated time in CPU cycles
+void avrsim_delay_us(double us);    // Advance the simulated time, interrupts keep running, called by _delay_us()
+
+// Unit tests drive the uart themselves, see test/
+void avrsim_uart_capture(void);                                 // Detach the uart from AVRSIM_UART and drop the bytes received and sent so far
+void avrsim_uart_receive(const uint8_t *data, size_t size);     // Queue bytes on the input of a captured uart, they arrive at the uart rate
+size_t avrsim_uart_sent(uint8_t *buffer, size_t size);          // Take the bytes a captured uart sent, returns their amount
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef AVRSIM_ATOMIC_H
+#define AVRSIM_ATOMIC_H
+
+// Blocks run with interrupts disabled, the simulator only interrupts at
+// avrsim_idle() and busy waits, so this mainly keeps SREG consistent
+
+#include "avr/io.h"
+
+static inline uint8_t avrsim_atomic_enter(void)
+{
+    uint8_t sreg = SREG;
+    SREG &= ~_BV(SREG_I);
+    return sreg;
+}
+
+static inline void avrsim_atomic_restore(const uint8_t *sreg)
+{
+    SREG = *sreg;
+}
+
+static inline void avrsim_atomic_force_on(const uint8_t *sreg)
+{
+    (void) sreg;
+    SREG |= _BV(SREG_I);
+}
+
+#define ATOMIC_RESTORESTATE uint8_t sreg_save __attribute__((__cleanup__(avrsim_atomic_restore))) = avrsim_atomic_enter()
+#define ATOMIC_FORCEON uint8_t sreg_save __attribute__((__cleanup__(avrsim_atomic_force_on))) = avrsim_atomic_enter()
+#define NONATOMIC_RESTORESTATE uint8_t sreg_save __attribute__((__cleanup__(avrsim_atomic_restore))) = SREG
+
+#define ATOMIC_BLOCK(type) for (type, avrsim_once = 1; avrsim_once; avrsim_once = 0)
+#define NONATOMIC_BLOCK(type) for (type, avrsim_once = 1; avrsim_once; avrsim_once = 0)
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef AVRSIM_CRC16_H
+#define AVRSIM_CRC16_H
+
+// The CRC update functions of avr-libc, same polynomials and bit order
+
+#include <stdint.h>
+
+// CRC-16 (0xA001 reflected), start with 0xFFFF
+static inline uint16_t _crc16_update(uint16_t crc, uint8_t data)
+{
+    crc ^= data;
+    for (uint8_t i = 0; i < 8; i++) {
+        crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : (crc >> 1);
+    }
+    return crc;
+}
+
+// CRC-CCITT (0x1021) as used by XMODEM, start with 0x0000
+static inline uint16_t _crc_xmodem_update(uint16_t crc, uint8_t data)
+{
+    crc ^= (uint16_t) data << 8;
+    for (uint8_t i = 0; i < 8; i++) {
+        crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
+    return crc;
+}
+
+// CRC-CCITT (0x8408 reflected), start with 0xFFFF
+static inline uint16_t _crc_ccitt_update(uint16_t crc, uint8_t data)
+{
+    data ^= (uint8_t) crc;
+    data ^= data << 4;
+    return ((((uint16_t) data << 8) | (crc >> 8)) ^ (uint8_t) (data >> 4) ^ ((uint16_t) data << 3));
+}
+
+// Dallas/Maxim 1-Wire CRC-8 (0x8C reflected), start with 0x00
+static inline uint8_t _crc_ibutton_update(uint8_t crc, uint8_t data)
+{
+    crc ^= data;
+    for (uint8_t i = 0; i < 8; i++) {
+        crc = (crc & 1) ? (crc >> 1) ^ 0x8C : (crc >> 1);
+    }
+    return crc;
+}
+
+#endif
@@ -0,0 +1,11 @@
+#ifndef AVRSIM_DELAY_H
+#define AVRSIM_DELAY_H
+
+// Busy waits advance the simulated time, interrupts keep firing meanwhile
+
+void avrsim_delay_us(double us);
+
+#define _delay_us(us) avrsim_delay_us(us)
+#define _delay_ms(ms) avrsim_delay_us((ms) * 1000.0)
+
+#endif
@@ -0,0 +1,167 @@
+/*------------------------------------------------------------------*-
+
+  avrbus.c
+
+  A simulated RS-485 multi-drop bus for avrsim stations.  The host
+  talks on a pseudo-terminal, the stations connect to a unix socket
+  with AVRSIM_UART set to its path.  Every byte of the host reaches
+  all stations, every byte of a station reaches the host and the
+  other stations, like on a shared pair of wires.
+
+  A transmitter holds the bus from its first byte until the line has
+  been idle for BUS_IDLE_US.  A byte of another transmitter during
+  that time collides: both transmitters are reported and the byte is
+  corrupted for everyone that listens.
+
+  Build and run, the stations run in real time to share the clock:
+
+    cc -O2 -o avrbus lib/avrsim/tools/avrbus.c
+    ./avrbus /tmp/bus.sock
+    AVRSIM_UART=/tmp/bus.sock AVRSIM_REALTIME=1 AVRSIM_EEPROM=s1.bin firmware
+
+-*------------------------------------------------------------------*/
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#define MAX_STATIONS 64
+#define BUS_IDLE_US 1500        // Idle time after which another transmitter may take the bus, 3 bytes at 19200 baud
+#define HOST 0                  // Index of the host in the descriptors, the stations follow
+
+static struct pollfd fds[1 + MAX_STATIONS + 1];
+static int count = 1;           // Amount of connected transmitters, the host included
+static int owner = -1;          // The transmitter that holds the bus, -1 when it is idle
+static long long owner_last = 0;   // Time of the last byte of the owner in microseconds
+static int collider = -1;       // The transmitter that collided with the owner, reported once per hold
+
+static long long now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static const char *name(int index)
+{
+    static char buffer[2][16];
+    static int next = 0;
+
+    next ^= 1;
+    if (index == HOST) {
+        return "host";
+    }
+    snprintf(buffer[next], sizeof(buffer[next]), "station %d", index);
+    return buffer[next];
+}
+
+// Put the bytes of a transmitter on the bus
+static void drive(int from, unsigned char *data, ssize_t n)
+{
+    long long t = now_us();
+
+    if (owner >= 0 && owner != from && t - owner_last < BUS_IDLE_US) {
+        if (collider != from) {
+            fprintf(stderr, "avrbus: collision of the %s and the %s\n", name(owner), name(from));
+            collider = from;
+        }
+        for (ssize_t i = 0; i < n; i++) {
+            data[i] ^= 0x5A;
+        }
+    }
+    else {
+        if (owner != from) {
+            collider = -1;
+        }
+        owner = from;
+    }
+    owner_last = t;
+
+    for (int i = 0; i < count; i++) {
+        if (i != from && fds[i].fd >= 0 && write(fds[i].fd, data, n) < 0) {
+            fds[i].fd = -1;
+        }
+    }
+}
+
+// Open the pseudo-terminal of the host in raw mode, the slave stays open so the host can reconnect
+static int open_host(void)
+{
+    struct termios tio;
+    int fd = posix_openpt(O_RDWR | O_NOCTTY);
+    int slave;
+
+    if (fd < 0 || grantpt(fd) < 0 || unlockpt(fd) < 0 || (slave = open(ptsname(fd), O_RDWR | O_NOCTTY)) < 0) {
+        perror("avrbus: pty");
+        exit(1);
+    }
+    tcgetattr(slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+    printf("avrbus: host on %s\n", ptsname(fd));
+    fflush(stdout);
+    return fd;
+}
+
+int main(int argc, char **argv)
+{
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    unsigned char data[256];
+    int listener;
+
+    if (argc != 2) {
+        fprintf(stderr, "usage: avrbus <socket>\n");
+        return 2;
+    }
+
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    strncpy(addr.sun_path, argv[1], sizeof(addr.sun_path) - 1);
+    unlink(argv[1]);
+    if (listener < 0 || bind(listener, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(listener, 8) < 0) {
+        perror("avrbus: socket");
+        return 1;
+    }
+
+    fds[HOST].fd = open_host();
+    fds[HOST].events = POLLIN;
+
+    while (1) {
+        // The listener is polled after the transmitters
+        fds[count].fd = listener;
+        fds[count].events = POLLIN;
+        if (poll(fds, count + 1, -1) < 0) {
+            perror("avrbus: poll");
+            return 1;
+        }
+
+        for (int i = 0; i < count; i++) {
+            if (fds[i].fd >= 0 && (fds[i].revents & (POLLIN | POLLHUP))) {
+                ssize_t n = read(fds[i].fd, data, sizeof(data));
+                if (n > 0) {
+                    drive(i, data, n);
+                }
+                else if (i != HOST) {
+                    fprintf(stderr, "avrbus: %s left\n", name(i));
+                    close(fds[i].fd);
+                    fds[i].fd = -1;
+                }
+            }
+        }
+
+        if ((fds[count].revents & POLLIN) && count <= MAX_STATIONS) {
+            fds[count].fd = accept(listener, NULL, NULL);
+            fds[count].events = POLLIN;
+            fprintf(stderr, "avrbus: %s joined\n", name(count));
+            count++;
+        }
+    }
+}
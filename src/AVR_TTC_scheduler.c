@@ -1,10 +1,37 @@
 #include "AVR_TTC_scheduler.h"
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include <util/atomic.h>
 
 // The array of tasks
 sTask SCH_tasks_G[SCH_MAX_TASKS];
 
+// Number of ticks covered by the pending compare match
+static unsigned char SCH_window_G = 1;
+
+#if SCH_DELTA_QUEUE
+// First task of the delta queue and first free task slot
+static unsigned char SCH_head_G = SCH_END;
+static unsigned char SCH_free_G = SCH_END;
+#endif
+
+static void SCH_Go_To_Sleep(void);
+static unsigned char SCH_Next_Ready(void);
+static void SCH_Release(const unsigned char, const unsigned int);
+static unsigned int SCH_Now(void);
+static unsigned int SCH_Elapsed_Ticks(void);
+static void SCH_Shorten_Window(const unsigned int);
+#if SCH_STATS
+static void SCH_Record_Start(const unsigned char, const unsigned int);
+static void SCH_Record_End(const unsigned char, const unsigned int);
+static void SCH_Reset_Stats(const unsigned char);
+#endif
+#if SCH_DELTA_QUEUE
+static void SCH_Insert(const unsigned char, unsigned int);
+static void SCH_Unlink(const unsigned char);
+#endif
+
 
 /*------------------------------------------------------------------*-
 
@@ -19,23 +46,44 @@ sTask SCH_tasks_G[SCH_MAX_TASKS];
 void SCH_Dispatch_Tasks(void)
 {
    unsigned char Index;
-
-   // Dispatches (runs) the next task (if one is ready)
-   for(Index = 0; Index < SCH_MAX_TASKS; Index++)
+   void (*pTask)(void);
+#if SCH_STATS
+   unsigned int Start;
+#endif
+
+   // Dispatches (runs) the ready tasks, highest priority first; the
+   // choice is made again after every task, so a task that became
+   // ready meanwhile with a higher priority goes next
+   while((Index = SCH_Next_Ready()) != SCH_MAX_TASKS)
    {
-      if((SCH_tasks_G[Index].RunMe > 0) && (SCH_tasks_G[Index].pTask != 0))
+#if SCH_STATS
+      Start = SCH_Now();
+      SCH_Record_Start(Index, Start);
+#endif
+      // The run is taken from the slot before the task runs: a task
+      // that deletes itself and adds a task again may get the same
+      // slot back, which then belongs to the new task
+      pTask = SCH_tasks_G[Index].pTask;
+      ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
       {
-         (*SCH_tasks_G[Index].pTask)();  // Run the task
          SCH_tasks_G[Index].RunMe -= 1;   // Reset / reduce RunMe flag
+      }
 
-         // Periodic tasks will automatically run again
-         // - if this is a 'one shot' task, remove it from the array
-         if(SCH_tasks_G[Index].Period == 0)
-         {
-            SCH_Delete_Task(Index);
-         }
+      // Periodic tasks will automatically run again
+      // - if this is a 'one shot' task, remove it from the array
+      if(SCH_tasks_G[Index].Period == 0)
+      {
+         SCH_Delete_Task(Index);
       }
+
+      (*pTask)();  // Run the task
+#if SCH_STATS
+      SCH_Record_End(Index, (uint16_t)(SCH_Now() - Start));
+#endif
    }
+
+   // The scheduler enters idle mode at this point
+   SCH_Go_To_Sleep();
 }
 
 /*------------------------------------------------------------------*-
@@ -84,6 +132,42 @@ void SCH_Dispatch_Tasks(void)
  
 -*------------------------------------------------------------------*/
 
+#if SCH_DELTA_QUEUE
+
+unsigned char SCH_Add_Task(void (*pFunction)(), const unsigned int DELAY, const unsigned int PERIOD)
+{
+   unsigned char Index;
+
+   ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+   {
+      // Take a slot from the free list
+      Index = SCH_free_G;
+      if(Index == SCH_END)
+      {
+         // Task list is full, return an error code
+         return SCH_MAX_TASKS;
+      }
+      SCH_free_G = SCH_tasks_G[Index].Next;
+
+      SCH_tasks_G[Index].pTask = pFunction;
+      SCH_tasks_G[Index].Period = PERIOD;
+      SCH_tasks_G[Index].RunMe = 0;
+      SCH_tasks_G[Index].Priority = 0;
+#if SCH_STATS
+      SCH_Reset_Stats(Index);
+#endif
+
+      // The queue counts from the last compare match, the task is due after DELAY + 1 ticks
+      SCH_Insert(Index, SCH_Elapsed_Ticks() + DELAY + 1);
+      SCH_Shorten_Window(SCH_tasks_G[SCH_head_G].Delay);
+   }
+
+   // return position of task (to allow later deletion)
+   return Index;
+}
+
+#else
+
 unsigned char SCH_Add_Task(void (*pFunction)(), const unsigned int DELAY, const unsigned int PERIOD)
 {
    unsigned char Index = 0;
@@ -102,15 +186,110 @@ unsigned char SCH_Add_Task(void (*pFunction)(), const unsigned int DELAY, const
    }
 
    // If we're here, there is a space in the task array
-   SCH_tasks_G[Index].pTask = pFunction;
-   SCH_tasks_G[Index].Delay =DELAY;
-   SCH_tasks_G[Index].Period = PERIOD;
-   SCH_tasks_G[Index].RunMe = 0;
+   ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+   {
+      // Count the delay from the last compare match, like the ISR does
+      SCH_tasks_G[Index].pTask = pFunction;
+      SCH_tasks_G[Index].Delay = DELAY + SCH_Elapsed_Ticks();
+      SCH_tasks_G[Index].Period = PERIOD;
+      SCH_tasks_G[Index].RunMe = 0;
+      SCH_tasks_G[Index].Priority = 0;
+#if SCH_STATS
+      SCH_Reset_Stats(Index);
+#endif
+
+      SCH_Shorten_Window(SCH_tasks_G[Index].Delay + 1);
+   }
 
    // return position of task (to allow later deletion)
    return Index;
 }
 
+#endif
+
+/*------------------------------------------------------------------*-
+
+  SCH_Add_Event_Task()
+
+  Adds a task that has no timing of its own: it runs once for every
+  call to SCH_Signal_Task(), as soon as the dispatcher gets to it.
+  Use it to hand the result of an interrupt to task code without
+  polling.
+
+  pFunction - The name of the function which is to be scheduled.
+
+  RETURN VALUE:  The position in the task array, or SCH_MAX_TASKS
+                 if there was insufficient space (see SCH_Add_Task()).
+
+-*------------------------------------------------------------------*/
+
+unsigned char SCH_Add_Event_Task(void (*pFunction)())
+{
+   unsigned char Index;
+
+   ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+   {
+#if SCH_DELTA_QUEUE
+      // Take a slot from the free list, event tasks never enter the queue
+      Index = SCH_free_G;
+      if(Index == SCH_END)
+      {
+         return SCH_MAX_TASKS;
+      }
+      SCH_free_G = SCH_tasks_G[Index].Next;
+#else
+      // Find a gap in the array
+      for(Index = 0; (Index < SCH_MAX_TASKS) && (SCH_tasks_G[Index].pTask != 0); Index++);
+      if(Index == SCH_MAX_TASKS)
+      {
+         return SCH_MAX_TASKS;
+      }
+#endif
+
+      SCH_tasks_G[Index].pTask = pFunction;
+      SCH_tasks_G[Index].Delay = 0;
+      SCH_tasks_G[Index].Period = SCH_EVENT;
+      SCH_tasks_G[Index].RunMe = 0;
+      SCH_tasks_G[Index].Priority = 0;
+#if SCH_STATS
+      SCH_Reset_Stats(Index);
+#endif
+   }
+
+   return Index;
+}
+
+/*------------------------------------------------------------------*-
+
+  SCH_Signal_Task()
+
+  Releases an event task, it runs once for every signal.  Safe to
+  call from an interrupt service routine.
+
+  TASK_INDEX - The task index.  Provided by SCH_Add_Event_Task().
+
+  RETURN VALUE:  1 if the task was released, 0 if there is no event
+                 task at TASK_INDEX.
+
+-*------------------------------------------------------------------*/
+
+unsigned char SCH_Signal_Task(const unsigned char TASK_INDEX)
+{
+   unsigned char Return_code = 0;
+
+   ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+   {
+      if((TASK_INDEX < SCH_MAX_TASKS) && (SCH_tasks_G[TASK_INDEX].pTask != 0) &&
+         (SCH_tasks_G[TASK_INDEX].Period == SCH_EVENT))
+      {
+         SCH_Release(TASK_INDEX, TCNT1);
+         Return_code = 1;
+      }
+   }
+
+   return Return_code;
+}
+
 /*------------------------------------------------------------------*-
 
   SCH_Delete_Task()
@@ -130,14 +309,238 @@ unsigned char SCH_Delete_Task(const unsigned char TASK_INDEX)
    // Return_code can be used for error reporting, NOT USED HERE THOUGH!
    unsigned char Return_code = 0;
 
-   SCH_tasks_G[TASK_INDEX].pTask = 0;
-   SCH_tasks_G[TASK_INDEX].Delay = 0;
-   SCH_tasks_G[TASK_INDEX].Period = 0;
-   SCH_tasks_G[TASK_INDEX].RunMe = 0;
+   ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+   {
+#if SCH_DELTA_QUEUE
+      // Take the task out of the queue and give the slot back
+      if(SCH_tasks_G[TASK_INDEX].pTask != 0)
+      {
+         SCH_Unlink(TASK_INDEX);
+         SCH_tasks_G[TASK_INDEX].Next = SCH_free_G;
+         SCH_free_G = TASK_INDEX;
+      }
+#endif
+      SCH_tasks_G[TASK_INDEX].pTask = 0;
+      SCH_tasks_G[TASK_INDEX].Delay = 0;
+      SCH_tasks_G[TASK_INDEX].Period = 0;
+      SCH_tasks_G[TASK_INDEX].RunMe = 0;
+   }
 
    return Return_code;
 }
 
+/*------------------------------------------------------------------*-
+
+  SCH_Set_Priority()
+
+  Sets the priority of a task.  When several tasks are ready,
+  the dispatcher runs the one with the highest priority first.
+  Tasks start with priority 0.
+
+  TASK_INDEX - The task index.  Provided by SCH_Add_Task().
+
+  PRIORITY   - The new priority, higher values run first.
+
+  RETURN VALUE:  1 if the priority was set, 0 if there is no task
+                 at TASK_INDEX.
+
+-*------------------------------------------------------------------*/
+
+unsigned char SCH_Set_Priority(const unsigned char TASK_INDEX, const unsigned char PRIORITY)
+{
+   if((TASK_INDEX >= SCH_MAX_TASKS) || (SCH_tasks_G[TASK_INDEX].pTask == 0))
+   {
+      return 0;
+   }
+
+   SCH_tasks_G[TASK_INDEX].Priority = PRIORITY;
+   return 1;
+}
+
+/*------------------------------------------------------------------*-
+
+  SCH_Release()
+
+  Flags a task to run.  Called from the ISR with the timer count
+  of the compare match; a release while the previous one has not
+  run yet is a missed deadline.
+
+-*------------------------------------------------------------------*/
+
+static void SCH_Release(const unsigned char TASK_INDEX, const unsigned int NOW)
+{
+#if SCH_STATS
+   if(SCH_tasks_G[TASK_INDEX].RunMe == 0)
+   {
+      SCH_tasks_G[TASK_INDEX].Stats.Release = NOW;
+   }
+   else if(SCH_tasks_G[TASK_INDEX].Stats.Missed < 0xFFFF)
+   {
+      SCH_tasks_G[TASK_INDEX].Stats.Missed++;
+   }
+#else
+   (void) NOW;
+#endif
+   SCH_tasks_G[TASK_INDEX].RunMe += 1;
+}
+
+/*------------------------------------------------------------------*-
+
+  SCH_Now()
+
+  Returns the free running Timer 1 count (SCH_US_PER_COUNT per
+  count).  The 16 bit read shares the TEMP register with the ISR,
+  so interrupts are disabled while reading.
+
+-*------------------------------------------------------------------*/
+
+static unsigned int SCH_Now(void)
+{
+   unsigned int Now;
+
+   ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+   {
+      Now = TCNT1;
+   }
+   return Now;
+}
+
+#if SCH_STATS
+
+/*------------------------------------------------------------------*-
+
+  SCH_Record_Start() / SCH_Record_End()
+
+  Update the statistics of a task around a run: the release
+  jitter (start minus release), the RunMe backlog and the
+  execution time.
+
+-*------------------------------------------------------------------*/
+
+static void SCH_Record_Start(const unsigned char TASK_INDEX, const unsigned int START)
+{
+   sTaskStats *pStats = &SCH_tasks_G[TASK_INDEX].Stats;
+   unsigned int Jitter;
+
+   ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+   {
+      Jitter = (uint16_t)(START - pStats->Release);
+      if(SCH_tasks_G[TASK_INDEX].RunMe > pStats->BacklogMax)
+      {
+         pStats->BacklogMax = SCH_tasks_G[TASK_INDEX].RunMe;
+      }
+   }
+
+   if(Jitter > pStats->JitterMax)
+   {
+      pStats->JitterMax = Jitter;
+   }
+}
+
+static void SCH_Record_End(const unsigned char TASK_INDEX, const unsigned int DURATION)
+{
+   sTaskStats *pStats = &SCH_tasks_G[TASK_INDEX].Stats;
+
+   if(DURATION < pStats->ExecMin)
+   {
+      pStats->ExecMin = DURATION;
+   }
+   if(DURATION > pStats->ExecMax)
+   {
+      pStats->ExecMax = DURATION;
+   }
+
+   // Halve the totals before they overflow, the average stays the same
+   if(pStats->Runs == 0xFFFF)
+   {
+      pStats->Runs /= 2;
+      pStats->ExecTotal /= 2;
+   }
+   pStats->Runs++;
+   pStats->ExecTotal += DURATION;
+}
+
+static void SCH_Reset_Stats(const unsigned char TASK_INDEX)
+{
+   sTaskStats *pStats = &SCH_tasks_G[TASK_INDEX].Stats;
+
+   pStats->ExecMin = 0xFFFF;
+   pStats->ExecMax = 0;
+   pStats->ExecTotal = 0;
+   pStats->Runs = 0;
+   pStats->JitterMax = 0;
+   pStats->Missed = 0;
+   pStats->BacklogMax = 0;
+}
+
+/*------------------------------------------------------------------*-
+
+  SCH_Get_Stats()
+
+  Copies the statistics of a task.
+
+  TASK_INDEX - The task index.  Provided by SCH_Add_Task().
+
+  RESET      - If non-zero, the statistics start over after the copy.
+
+  RETURN VALUE:  1 if the copy was made, 0 if there is no task at
+                 TASK_INDEX.
+
+-*------------------------------------------------------------------*/
+
+unsigned char SCH_Get_Stats(const unsigned char TASK_INDEX, sTaskStats *pStats, const unsigned char RESET)
+{
+   if((TASK_INDEX >= SCH_MAX_TASKS) || (SCH_tasks_G[TASK_INDEX].pTask == 0))
+   {
+      return 0;
+   }
+
+   ATOMIC_BLOCK(ATOMIC_RESTORESTATE)
+   {
+      *pStats = SCH_tasks_G[TASK_INDEX].Stats;
+      if(RESET)
+      {
+         SCH_Reset_Stats(TASK_INDEX);
+      }
+   }
+   return 1;
+}
+
+#endif
+
+/*------------------------------------------------------------------*-
+
+  SCH_Elapsed_Ticks()
+
+  Returns the number of whole ticks since the last compare match.
+
+-*------------------------------------------------------------------*/
+
+static unsigned int SCH_Elapsed_Ticks(void)
+{
+   // Timer 1 differences wrap at 16 bits, also where int is wider than on the AVR
+   return (uint16_t)(SCH_Now() - (uint16_t)(OCR1A - SCH_window_G * SCH_TICK_COUNTS)) / SCH_TICK_COUNTS;
+}
+
+/*------------------------------------------------------------------*-
+
+  SCH_Shorten_Window()
+
+  Cuts the pending window short when a task added in the middle
+  of it is due after TICKS ticks (counted from the last compare
+  match), before the window ends.
+
+-*------------------------------------------------------------------*/
+
+static void SCH_Shorten_Window(const unsigned int TICKS)
+{
+   if(TICKS < SCH_window_G)
+   {
+      OCR1A -= (SCH_window_G - TICKS) * SCH_TICK_COUNTS;
+      SCH_window_G = TICKS;
+   }
+}
+
 /*------------------------------------------------------------------*-
 
   SCH_Init_T1()
@@ -154,16 +557,35 @@ void SCH_Init_T1(void)
 
    for(i = 0; i < SCH_MAX_TASKS; i++)
    {
+      SCH_tasks_G[i].pTask = 0;
       SCH_Delete_Task(i);
    }
 
+#if SCH_DELTA_QUEUE
+   // Put every slot on the free list
+   SCH_head_G = SCH_END;
+   SCH_free_G = SCH_END;
+   for(i = SCH_MAX_TASKS; i > 0; i--)
+   {
+      SCH_tasks_G[i - 1].Next = SCH_free_G;
+      SCH_free_G = i - 1;
+   }
+#endif
+
    // Set up Timer 1
-   // Values for 1ms and 10ms ticks are provided for various crystals
+   // Timer 1 runs freely, every compare match moves OCR1A forward by
+   // one or more ticks (see SCH_Update)
 
    // Hier moet de timer periode worden aangepast ....!
-   OCR1A = (uint16_t)625;   		     // 10ms = (256/16.000.000) * 625
-   TCCR1B = (1 << CS12) | (1 << WGM12);  // prescale op 64, top counter = value OCR1A (CTC mode)
-   TIMSK1 = 1 << OCIE1A;   		     // Timer 1 Output Compare A Match Interrupt Enable
+   SCH_window_G = 1;
+   TCCR1A = 0;
+   TCNT1 = 0;
+   OCR1A = (uint16_t)SCH_TICK_COUNTS;    // 10ms = (64/16.000.000) * 2500
+   TCCR1B = (1 << CS11) | (1 << CS10);   // prescale op 64, normal mode (free running)
+   TIMSK1 = 1 << OCIE1A;                 // Timer 1 Output Compare A Match Interrupt Enable
+
+   // Idle mode keeps the timers, the USART and the ADC running
+   set_sleep_mode(SLEEP_MODE_IDLE);
 }
 
 /*------------------------------------------------------------------*-
@@ -184,6 +606,61 @@ void SCH_Start(void)
       sei();
 }
 
+/*------------------------------------------------------------------*-
+
+  SCH_Go_To_Sleep()
+
+  Puts the processor in idle mode until the next interrupt, unless a
+  task is ready to run.  Interrupts are disabled while the RunMe flags
+  are checked; sei() delays interrupts by one instruction, so an
+  interrupt that arrives in between wakes the processor right away.
+
+-*------------------------------------------------------------------*/
+
+static void SCH_Go_To_Sleep(void)
+{
+   cli();
+   if(SCH_Next_Ready() != SCH_MAX_TASKS)
+   {
+      // A task is ready, do not sleep
+      sei();
+      return;
+   }
+
+   sleep_enable();
+   sei();
+   sleep_cpu();
+   sleep_disable();
+}
+
+/*------------------------------------------------------------------*-
+
+  SCH_Next_Ready()
+
+  Returns the index of the ready task with the highest priority
+  (the lowest index among equal priorities), or SCH_MAX_TASKS if
+  no task is ready.
+
+-*------------------------------------------------------------------*/
+
+static unsigned char SCH_Next_Ready(void)
+{
+   unsigned char Index;
+   unsigned char Best = SCH_MAX_TASKS;
+
+   for(Index = 0; Index < SCH_MAX_TASKS; Index++)
+   {
+      if((SCH_tasks_G[Index].RunMe > 0) && (SCH_tasks_G[Index].pTask != 0))
+      {
+         if((Best == SCH_MAX_TASKS) || (SCH_tasks_G[Index].Priority > SCH_tasks_G[Best].Priority))
+         {
+            Best = Index;
+         }
+      }
+   }
+   return Best;
+}
+
 /*------------------------------------------------------------------*-
 
   SCH_Update
@@ -191,33 +668,197 @@ void SCH_Start(void)
   This is the scheduler ISR.  It is called at a rate 
   determined by the timer settings in SCH_Init_T1().
 
+  A compare match covers SCH_window_G ticks.  Idle ticks are
+  skipped: the next compare match is set to the first tick at
+  which a task becomes due (at most SCH_MAX_SKIP ticks ahead),
+  and the delays are reduced by the whole window at once so the
+  task periods stay exact.
+
 -*------------------------------------------------------------------*/
 
+#if !SCH_DELTA_QUEUE
+
 ISR(TIMER1_COMPA_vect)
 {
    unsigned char Index;
+   unsigned char Ticks = SCH_window_G;
+   unsigned char Next = SCH_MAX_SKIP;
+   unsigned int Late;
+   unsigned int Now = OCR1A;
+
    for(Index = 0; Index < SCH_MAX_TASKS; Index++)
    {
-      // Check if there is a task at this location
-      if(SCH_tasks_G[Index].pTask)
+      // Check if there is a task at this location, event tasks only run when signalled
+      if(SCH_tasks_G[Index].pTask && (SCH_tasks_G[Index].Period != SCH_EVENT))
       {
-         if(SCH_tasks_G[Index].Delay == 0)
+         if(SCH_tasks_G[Index].Delay < Ticks)
          {
             // The task is due to run, Inc. the 'RunMe' flag
-            SCH_tasks_G[Index].RunMe += 1;
+            SCH_Release(Index, Now);
 
             if(SCH_tasks_G[Index].Period)
             {
-               // Schedule periodic tasks to run again
-               SCH_tasks_G[Index].Delay = SCH_tasks_G[Index].Period;
-               SCH_tasks_G[Index].Delay -= 1;
+               // Schedule periodic tasks to run again, counted from the tick they were due
+               Late = Ticks - 1 - SCH_tasks_G[Index].Delay;
+               SCH_tasks_G[Index].Delay = (SCH_tasks_G[Index].Period > Late) ? SCH_tasks_G[Index].Period - 1 - Late : 0;
+            }
+            else
+            {
+               SCH_tasks_G[Index].Delay = 0;
             }
          }
          else
          {
             // Not yet ready to run: just decrement the delay
-            SCH_tasks_G[Index].Delay -= 1;
+            SCH_tasks_G[Index].Delay -= Ticks;
+         }
+
+         // Find the first tick at which a task is due
+         if(SCH_tasks_G[Index].Delay < Next)
+         {
+            Next = SCH_tasks_G[Index].Delay + 1;
          }
       }
    }
-}
\ No newline at end of file
+
+   // Skip the idle ticks
+   SCH_window_G = Next;
+   OCR1A += Next * SCH_TICK_COUNTS;
+}
+
+#endif
+
+#if SCH_DELTA_QUEUE
+
+/*------------------------------------------------------------------*-
+
+  SCH_Insert()
+
+  Inserts a task in the delta queue.  Every queued task stores
+  its delay relative to the task in front of it; the head stores
+  its delay relative to the last compare match.  Tasks that are
+  due at the same tick keep the order in which they were queued.
+
+  TICKS - The number of ticks until the task is due, at least 1.
+
+-*------------------------------------------------------------------*/
+
+static void SCH_Insert(const unsigned char TASK_INDEX, unsigned int TICKS)
+{
+   unsigned char Previous = SCH_END;
+   unsigned char Index = SCH_head_G;
+
+   // Walk past the tasks that are due before or at the same tick
+   while((Index != SCH_END) && (SCH_tasks_G[Index].Delay <= TICKS))
+   {
+      TICKS -= SCH_tasks_G[Index].Delay;
+      Previous = Index;
+      Index = SCH_tasks_G[Index].Next;
+   }
+
+   SCH_tasks_G[TASK_INDEX].Delay = TICKS;
+   SCH_tasks_G[TASK_INDEX].Next = Index;
+   if(Index != SCH_END)
+   {
+      SCH_tasks_G[Index].Delay -= TICKS;
+   }
+
+   if(Previous == SCH_END)
+   {
+      SCH_head_G = TASK_INDEX;
+   }
+   else
+   {
+      SCH_tasks_G[Previous].Next = TASK_INDEX;
+   }
+}
+
+/*------------------------------------------------------------------*-
+
+  SCH_Unlink()
+
+  Takes a task out of the delta queue, if it is queued.  The next
+  task inherits its delay.
+
+-*------------------------------------------------------------------*/
+
+static void SCH_Unlink(const unsigned char TASK_INDEX)
+{
+   unsigned char Previous = SCH_END;
+   unsigned char Index = SCH_head_G;
+
+   while((Index != SCH_END) && (Index != TASK_INDEX))
+   {
+      Previous = Index;
+      Index = SCH_tasks_G[Index].Next;
+   }
+
+   if(Index == SCH_END)
+   {
+      // Not queued (a one shot task that is waiting to be dispatched)
+      return;
+   }
+
+   Index = SCH_tasks_G[TASK_INDEX].Next;
+   if(Index != SCH_END)
+   {
+      SCH_tasks_G[Index].Delay += SCH_tasks_G[TASK_INDEX].Delay;
+   }
+
+   if(Previous == SCH_END)
+   {
+      SCH_head_G = Index;
+   }
+   else
+   {
+      SCH_tasks_G[Previous].Next = Index;
+   }
+}
+
+/*------------------------------------------------------------------*-
+
+  SCH_Update
+
+  This is the scheduler ISR of the delta queue engine.  Only the
+  head of the queue is touched, unless tasks are due: those are
+  taken off the queue, flagged to run and (if periodic) queued
+  again relative to the tick they were due.  The cost of a tick
+  does not depend on SCH_MAX_TASKS.
+
+-*------------------------------------------------------------------*/
+
+ISR(TIMER1_COMPA_vect)
+{
+   unsigned int Ticks = SCH_window_G;
+   unsigned char Index;
+   unsigned int Now = OCR1A;
+
+   while((SCH_head_G != SCH_END) && (SCH_tasks_G[SCH_head_G].Delay <= Ticks))
+   {
+      // The task is due to run, Inc. the 'RunMe' flag
+      Index = SCH_head_G;
+      Ticks -= SCH_tasks_G[Index].Delay;
+      SCH_head_G = SCH_tasks_G[Index].Next;
+      SCH_Release(Index, Now);
+
+      if(SCH_tasks_G[Index].Period)
+      {
+         // Schedule periodic tasks to run again
+         SCH_Insert(Index, SCH_tasks_G[Index].Period);
+      }
+   }
+
+   // Skip the idle ticks until the head is due
+   if(SCH_head_G != SCH_END)
+   {
+      SCH_tasks_G[SCH_head_G].Delay -= Ticks;
+      SCH_window_G = (SCH_tasks_G[SCH_head_G].Delay < SCH_MAX_SKIP) ? SCH_tasks_G[SCH_head_G].Delay : SCH_MAX_SKIP;
+   }
+   else
+   {
+      SCH_window_G = SCH_MAX_SKIP;
+   }
+   OCR1A += SCH_window_G * SCH_TICK_COUNTS;
+}
+
+#endif
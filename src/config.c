@@ -0,0 +1,114 @@
+#include "config.h"
+#include <stddef.h>
+#include <string.h>
+#include "avr/eeprom.h"
+#include "avr/interrupt.h"
+#include "util/atomic.h"
+#include "util/crc16.h"
+
+static unsigned char configSlot = CONFIG_SLOTS - 1;    //The slot of the current record
+static uint16_t configSequence = 0;                     //The sequence of the current record
+static Config configShadow;                             //The newest saved config, copied into the next record
+static ConfigRecord configWrite;                        //The record the EEPROM interrupt is writing
+static unsigned char configIndex = sizeof(ConfigRecord);   //The next byte of configWrite to write, the record is complete at its size
+static volatile unsigned char configDirty = 0;          //Set when the shadow changed after configWrite was made
+
+//Calculate the CRC of a record
+static uint16_t record_crc(const ConfigRecord* record)
+{
+    const unsigned char* bytes = (const unsigned char*) record;
+    uint16_t crc = 0xFFFF;
+
+    for(unsigned char i = 0; i < offsetof(ConfigRecord, crc); i++){
+        crc = _crc16_update(crc, bytes[i]);
+    }
+    return crc;
+}
+
+//Load the newest valid record from the slots
+unsigned char config_load(Config* config)
+{
+    ConfigRecord record;
+    unsigned char found = 0;
+
+    memset(config, 0, sizeof(Config));
+
+    for(unsigned char slot = 0; slot < CONFIG_SLOTS; slot++){
+        eeprom_read_block(&record, (const void*) (uintptr_t) (slot * CONFIG_SLOT_SIZE), sizeof(ConfigRecord));
+
+        //Erased and half written slots fail the check
+        if(record.version != CONFIG_VERSION || record.crc != record_crc(&record)){
+            continue;
+        }
+
+        //Keep the newest, the sequence may have wrapped around
+        if(!found || (int16_t) (record.sequence - configSequence) > 0){
+            memcpy(config, &record.config, sizeof(Config));
+            configSlot = slot;
+            configSequence = record.sequence;
+            found = 1;
+        }
+    }
+    return found;
+}
+
+//Queue the config for a new record, the EEPROM interrupt writes it in the background
+void config_save(const Config* config)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        memcpy(&configShadow, config, sizeof(Config));
+        configDirty = 1;
+
+        //The interrupt fires as soon as the EEPROM is ready, a save during a write is picked up after it
+        EECR |= (1<<EERIE);
+    }
+}
+
+//Make the record of the shadow for the slot after the current record
+static void next_record()
+{
+    configSlot = (configSlot + 1) % CONFIG_SLOTS;
+    configSequence++;
+
+    configWrite.sequence = configSequence;
+    configWrite.version = CONFIG_VERSION;
+    memcpy(&configWrite.config, &configShadow, sizeof(Config));
+    configWrite.crc = record_crc(&configWrite);
+
+    configIndex = 0;
+    configDirty = 0;
+}
+
+//Write the next changed byte of the record, the current record stays valid until the CRC of the new one is written
+ISR(EE_READY_vect)
+{
+    const unsigned char* bytes = (const unsigned char*) &configWrite;
+    unsigned short address;
+
+    //Saves during the last record are coalesced into one new record
+    if(configIndex >= sizeof(ConfigRecord)){
+        if(!configDirty){
+            EECR &= ~(1<<EERIE);
+            return;
+        }
+        next_record();
+    }
+
+    //Skip the bytes that already hold their value
+    address = configSlot * CONFIG_SLOT_SIZE;
+    while(configIndex < sizeof(ConfigRecord)){
+        EEAR = address + configIndex;
+        EECR |= (1<<EERE);
+        if(EEDR != bytes[configIndex]){
+            break;
+        }
+        configIndex++;
+    }
+
+    //Start the byte write, the interrupt fires again when it ends
+    if(configIndex < sizeof(ConfigRecord)){
+        EEDR = bytes[configIndex++];
+        EECR |= (1<<EEMPE);
+        EECR |= (1<<EEPE);
+    }
+}
@@ -0,0 +1,30 @@
+#include "filter.h"
+
+//Empty the filter
+void filter_reset(MovingAverage* filter)
+{
+    filter->sum = 0;
+    filter->index = 0;
+    filter->filled = 0;
+}
+
+//Add a sample and return the average, the running sum keeps the cost the same for every length
+unsigned short filter_update(MovingAverage* filter, unsigned short sample)
+{
+    //Start from the first sample instead of averaging with zeros
+    if(!filter->filled){
+        for(unsigned char i = 0; i < FILTER_LENGTH; i++){
+            filter->samples[i] = sample;
+        }
+        filter->sum = (unsigned long) sample << FILTER_SHIFT;
+        filter->filled = 1;
+    }
+
+    //Replace the oldest sample in the sum
+    filter->sum += sample;
+    filter->sum -= filter->samples[filter->index];
+    filter->samples[filter->index] = sample;
+    filter->index = (filter->index + 1) & (FILTER_LENGTH - 1);
+
+    return filter->sum >> FILTER_SHIFT;
+}
@@ -0,0 +1,13 @@
+#include "fixed.h"
+
+//Convert an integer to fixed point, saturating at the range limits
+fixed_t fixed_from_long(long value)
+{
+    if(value > FIXED_TO_INT(FIXED_MAX)){
+        return FIXED_MAX;
+    }
+    if(value < FIXED_TO_INT(FIXED_MIN)){
+        return FIXED_MIN;
+    }
+    return FIXED_FROM_INT(value);
+}
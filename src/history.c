@@ -0,0 +1,143 @@
+#include "history.h"
+#include <stdint.h>
+#include <string.h>
+#include "serial.h"
+
+static unsigned char historyBlocks[HISTORY_BLOCKS][HISTORY_BLOCK_SIZE];  //The ring, the first byte of a block is its size
+static unsigned char historyHead = 0;                   //The block that is being filled
+static unsigned char historyCount = 0;                  //The amount of blocks in use
+static unsigned long historyTime = 0;                   //The sample number of the next sample
+static unsigned long historyLast = 0;                   //The sample number of the last stored sample
+static fixed_t lastValues[HISTORY_VALUES];              //The values of the last stored sample
+
+static unsigned char dumpRunning = 0;                   //Set while a dump frame is being sent
+static unsigned char dumpBlock = 0;                     //The block that is being sent
+static unsigned char dumpRemaining = 0;                 //The amount of blocks that still have to be sent
+static unsigned char dumpOffset = 0;                    //The bytes of the block that have been sent
+
+static unsigned char pendingSample = 0;                 //Set when a sample arrived during a dump
+static unsigned long pendingTime = 0;                   //The sample number of the pending sample
+static fixed_t pendingValues[HISTORY_VALUES];           //The values of the pending sample
+
+//Append a delta as a zigzag varint, small changes in both directions take one byte
+static unsigned char put_delta(unsigned char* block, unsigned char size, int16_t delta)
+{
+    uint16_t value = ((uint16_t) delta << 1) ^ (uint16_t) (delta >> 15);
+
+    while(value >= 0x80){
+        block[size++] = (value & 0x7F) | 0x80;
+        value >>= 7;
+    }
+    block[size++] = value;
+    return size;
+}
+
+//Store a sample, as delta when it follows the last sample and fits the block, otherwise as keyframe of a new block
+static void history_store(unsigned long time, const fixed_t* values)
+{
+    unsigned char* block = historyBlocks[historyHead];
+
+    if(historyCount > 0 && time == historyLast + 1 && block[0] + HISTORY_SAMPLE_MAX <= HISTORY_BLOCK_SIZE){
+        for(unsigned char i = 0; i < HISTORY_VALUES; i++){
+            block[0] = put_delta(block, block[0], (int16_t) (values[i] - lastValues[i]));
+        }
+    }else{
+        //Move to the next block, it holds the oldest samples once the ring is full
+        if(historyCount > 0){
+            historyHead = (historyHead + 1) % HISTORY_BLOCKS;
+        }
+        if(historyCount < HISTORY_BLOCKS){
+            historyCount++;
+        }
+
+        block = historyBlocks[historyHead];
+        block[0] = HISTORY_HEADER_SIZE;
+        for(unsigned char i = 0; i < 4; i++){
+            block[1 + i] = time >> (8 * i);
+        }
+        for(unsigned char i = 0; i < HISTORY_VALUES; i++){
+            block[5 + 2 * i] = (uint16_t) values[i];
+            block[6 + 2 * i] = (uint16_t) values[i] >> 8;
+        }
+    }
+
+    historyLast = time;
+    memcpy(lastValues, values, sizeof(lastValues));
+}
+
+//Add the sample of this period, during a dump it is stored when the dump is complete
+void history_add(const fixed_t* values)
+{
+    unsigned long time = historyTime++;
+
+    if(dumpRunning){
+        pendingSample = 1;
+        pendingTime = time;
+        memcpy(pendingValues, values, sizeof(pendingValues));
+        return;
+    }
+    history_store(time, values);
+}
+
+//Queue the header of the dump frame, the caller makes sure the transmit queue has room for it
+void history_dump_start(unsigned char command, unsigned char blocks)
+{
+    unsigned char header[HISTORY_DUMP_HEADER_SIZE];
+    unsigned int length = 0;
+
+    if(blocks == 0 || blocks > historyCount){
+        blocks = historyCount;
+    }
+
+    //Send from the oldest requested block, the blocks do not change until the dump is complete
+    dumpBlock = (historyHead + HISTORY_BLOCKS + 1 - blocks) % HISTORY_BLOCKS;
+    dumpRemaining = blocks;
+    dumpOffset = 0;
+    dumpRunning = 1;
+
+    for(unsigned char i = 0; i < blocks; i++){
+        length += historyBlocks[(dumpBlock + i) % HISTORY_BLOCKS][0];
+    }
+
+    header[0] = command;
+    header[1] = blocks;
+    header[2] = HISTORY_PERIOD;
+    header[3] = length;
+    header[4] = length >> 8;
+    frame_begin(0);
+    frame_append(header, HISTORY_DUMP_HEADER_SIZE);
+}
+
+//Send as much of the dump as the transmit queue takes
+unsigned char history_dump()
+{
+    while(dumpRunning){
+        //End the frame after the last block and store the sample that arrived meanwhile
+        if(dumpRemaining == 0){
+            if(!frame_end()){
+                return 1;
+            }
+            dumpRunning = 0;
+            if(pendingSample){
+                pendingSample = 0;
+                history_store(pendingTime, pendingValues);
+            }
+            break;
+        }
+
+        unsigned char* block = historyBlocks[dumpBlock];
+        unsigned char size = frame_append(&block[dumpOffset], block[0] - dumpOffset);
+
+        if(size == 0){
+            return 1;
+        }
+        dumpOffset += size;
+
+        if(dumpOffset == block[0]){
+            dumpBlock = (dumpBlock + 1) % HISTORY_BLOCKS;
+            dumpRemaining--;
+            dumpOffset = 0;
+        }
+    }
+    return 0;
+}
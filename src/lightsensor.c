@@ -2,5 +2,10 @@
 
 //Read the raw sensor data of the light sensor
 int readLightSensor(){
-    return analogRead(LIGHT_SENSOR_PIN_A);
+    return analogReadOversampled(LIGHT_SENSOR_PIN_A);
+}
+
+//Convert raw sensor data to a light intensity, the oversampled bits become the fraction
+fixed_t toLightIntensity(int raw){
+    return raw << (FIXED_FRAC_BITS - ADC_OVERSAMPLE_BITS);
 }
\ No newline at end of file
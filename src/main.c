@@ -1,21 +1,27 @@
-#define TEMPSENSOR 0 //Tempsensor mode, 0 means light 1 means temp
 #define DEBUG 0 //Debug mode
 
 #include "AVR_TTC_scheduler.h"
 #include "pa_io.h"
-
-#if TEMPSENSOR
-#include "tempsensor.h" 
-#else
-#include "lightsensor.h" 
-#endif
-
+#include "sensor.h"
 #include "ultrasound.h" 
+#include "filter.h"
+#include "config.h"
+#include "history.h"
 #include "serial.h"
 #include "util/delay.h"
 #include <stdio.h>
+#include <string.h>
 #include "avr/interrupt.h"
-#include "avr/eeprom.h"
+#include "avr/pgmspace.h"
+
+#define TELEMETRY_PERIOD 10 //The telemetry task period in ticks, every sample of the trigger sensor
+#define HISTORY_TICKS (HISTORY_PERIOD * 100) //The history task period in ticks
+#define DISTANCE_CONFIDENCE 60 //The minimum confidence in percent of a distance measurement, 3 of 5 pings agree
+
+//Task priorities, the other tasks have priority 0
+#define PRIORITY_DISTANCE 3 //update_distance feeds the stop decision
+#define PRIORITY_STATE 2    //update_state stops a transition at the distance limits
+#define PRIORITY_COMMAND 1  //parse_command handles the dashboard commands
 
 //LED port macros
 #define YELLOW_LED PB5
@@ -29,30 +35,39 @@ typedef enum{
     TRANSITIONING
 } State; //State enum with all possible program states
 
-const static unsigned char serial[] = {0xAC, 0x00, 0x00, 0x00}; // Last byte specifies type 0 = light, 1 = temp
-
-static volatile float distance = 0;             //The distance in Centimeter
-static volatile float maxDistance = 0;          //The maximum distance before stopping a transition
-static volatile float minDistance = 0;          //The minimum distance before stopping a transition
-
-#if TEMPSENSOR
-static volatile float temperature = 0;          //The temperature in Celsius
-static volatile float maxTemperature = 0;       //The maximum temperature before state change
-static volatile float minTemperature = 0;       //The minimum temperature before state change
-#else
-static volatile float lightIntensity = 0;       //The lightintensity with a resolution of 0-1024
-static volatile float maxLightIntensity = 0;    //The maximum light intensity before state change
-static volatile float minLightIntensity = 0;    //The minimum light intensity before state change
-#endif
-
-static const  int triggerMaxAddress = 0;        //The trigger max eeprom address
-static const  int triggerMinAddress = 4;        //The trigger min eeprom address
-static const  int distanceMaxAddress = 8;       //The distance max eeprom address
-static const  int distanceMinAddress = 12;      //The distance min eeprom address
+typedef struct Command{
+    unsigned char (*handler)(unsigned char* buffer, const struct Command* command); //The command handler, 0 for an invalid command
+    volatile fixed_t* field;                    //The variable that is read or written by the handler, of sensor 0 for a per sensor variable
+    unsigned char stride;                       //The bytes between the variables of two sensors, 0 when the variable is not per sensor
+} Command; //Command table entry
+
+typedef struct{
+    unsigned char mask;                         //The batch fields to push, 0 when there is no subscription
+    unsigned char period;                       //The push period in telemetry task runs, 0 to only report changes
+    unsigned char distanceDeadband;             //The distance change in centimeter that triggers a push
+    unsigned char triggerDeadband;              //The trigger sensor change that triggers a push
+    unsigned char counter;                      //The amount of telemetry task runs since the last push
+    unsigned char pending;                      //Set when a push is due regardless of the period and deadbands
+    fixed_t lastDistance;                       //The distance of the last push
+    fixed_t lastTrigger;                        //The trigger sensor value of the last push
+} Subscription; //Push telemetry subscription
+
+const static unsigned char serial[] = {0xAC, 0x00, 0x00, 0x00}; // Last byte is the type of the selected sensor, 0 = light, 1 = temp
+
+//All samples and thresholds are fixed point, they are only converted to floats in the protocol frames
+static volatile fixed_t distance = 0;           //The distance in Centimeter
+static Config settings = {0};                   //The thresholds, all 0 until the station is installed
+static volatile fixed_t sensorValues[SENSOR_COUNT] = {0};   //The filtered value of every sensor in its unit
+static unsigned char selectedSensor = 0;        //The sensor the trigger sensor commands and the UUID refer to, settings.selected after reset
+static unsigned char requestSensor = FRAME_SENSOR_NONE; //The sensor the request that is executed names, it overrides selectedSensor
 
 State currentState = NONE;                      //The program state
+static Subscription subscription = {0};         //The push telemetry subscription
+static MovingAverage sensorFilters[SENSOR_COUNT];   //Smooth the sensor samples so the state does not flap at a threshold
 char direction = 0;                             //The transition direction
 
+void update_distance();
+
 //Initialize all components of the program
 void initialize(){
     //Init the scheduler
@@ -61,39 +76,36 @@ void initialize(){
     //Init the UART serial connection
     serial_init();
 
-    //Init the ADC
+    //Init the ADC and the sensor filters
     adc_init();
+    for(unsigned char i = 0; i < SENSOR_COUNT; i++){
+        filter_reset(&sensorFilters[i]);
+    }
 
-    //Init the ultrasound 
-    setup_ultrasound();
+    //Init the ultrasound, it signals the distance task when a measurement ends
+    unsigned char distanceTask = SCH_Add_Event_Task(update_distance);
+    SCH_Set_Priority(distanceTask, PRIORITY_DISTANCE);
+    setup_ultrasound(distanceTask);
 
 #if DEBUG // Testing values
     //Set default values for debug purposes
-    #if TEMPSENSOR
-        maxTemperature = 30;
-        minTemperature = 28;
-    #else
-        maxLightIntensity = 600;
-        minLightIntensity = 400;
-    #endif
-
-    maxDistance = 30;
-    minDistance = 10;
+    settings.sensors[SENSOR_LIGHT].max = FIXED_FROM_INT(600);
+    settings.sensors[SENSOR_LIGHT].min = FIXED_FROM_INT(400);
+    settings.sensors[SENSOR_TEMPERATURE].max = FIXED_FROM_INT(30);
+    settings.sensors[SENSOR_TEMPERATURE].min = FIXED_FROM_INT(28);
+
+    settings.distanceMax = FIXED_FROM_INT(30);
+    settings.distanceMin = FIXED_FROM_INT(10);
 #else
-    #if TEMPSENSOR
-        //Read the temperature constraints from eeprom
-        maxTemperature = eeprom_read_float((float*) triggerMaxAddress);
-        minTemperature = eeprom_read_float((float*) triggerMinAddress);
-    #else
-        //Read the light intensity constraints from eeprom
-        maxLightIntensity = eeprom_read_float((float*) triggerMaxAddress);
-        minLightIntensity = eeprom_read_float((float*) triggerMinAddress);
-    #endif
-
-    //Read the distance constraints from eeprom
-    maxDistance = eeprom_read_float((float*) distanceMaxAddress);
-    minDistance = eeprom_read_float((float*) distanceMinAddress);
+    //Read the constraints from the newest valid eeprom record, they stay 0 when there is none
+    config_load(&settings);
 #endif
+    if(settings.selected < SENSOR_COUNT){
+        selectedSensor = settings.selected;
+    }
+
+    //Join the bus when the station has an address
+    serial_set_address(settings.address);
 
     //Set the Pins for the LED to output (portb)
     DDRB |= (1 << PORTB5);
@@ -101,167 +113,309 @@ void initialize(){
     DDRB |= (1 << PORTB3);
 }
 
-void execute(unsigned char* buffer) 
+//The sensor the trigger sensor commands refer to, the one the request names or else the selected sensor
+unsigned char active_sensor()
+{
+    return (requestSensor != FRAME_SENSOR_NONE) ? requestSensor : selectedSensor;
+}
+
+//Get the variable of a command, a per sensor variable is the one of the active sensor
+volatile fixed_t* command_field(const Command* command)
+{
+    return (volatile fixed_t*) ((volatile unsigned char*) command->field + command->stride * active_sensor());
+}
+
+//Reply with the value of a variable
+unsigned char read_field(unsigned char* buffer, const Command* command)
 {
-    // Reads the first packet from the buffer parameter and makes an empty content buffer
-    unsigned char raw_command = buffer[0];
     unsigned char content_buffer[4];
 
-    // Gets all the individual values from the raw_command variable
-    unsigned char function = (raw_command & CMD_FUNCTION_MASK);
-    unsigned char value = (raw_command & CMD_VALUE_MASK);
-    unsigned char id = (raw_command & CMD_ID_MASK);
-    
-    // Check if function is write
-    if (function == CMD_WRITE) { 
-        // Check if value is min
-        if (value == CMD_MODE_MIN) { 
-            // Check if id is distance
-            if (id == CMD_ID_DISTANCE) { 
-                // Get min distance value from buffer and write to EEPROM
-                get_content_bytes(buffer, content_buffer);
-                float val = bytes_to_float(content_buffer);
-                minDistance = val;
-                eeprom_update_float((float*)distanceMinAddress, val);
-            }
-            else if (id == CMD_ID_TRIGGER_SENSOR) { 
-                // Get min trigger value from buffer and write to EEPROM
-                get_content_bytes(buffer, content_buffer);
-                float val = bytes_to_float(content_buffer);
-                #if TEMPSENSOR
-                minTemperature = val;
-                #else
-                minLightIntensity = val;
-                #endif
-                eeprom_update_float((float*)triggerMinAddress, val);
-            }
-            else {
-                // Not a valid command, set error flags
-                set_error_flag(buffer, ERR_INVALID);
-            }
-        }
-        // Check if value is max
-        else if (value == CMD_MODE_MAX) { 
-            // Check if id is distance
-            if (id == CMD_ID_DISTANCE) { 
-                // Get max distance value from buffer and write to EEPROM
-                get_content_bytes(buffer, content_buffer);
-                float val = bytes_to_float(content_buffer);
-                maxDistance = val;
-                eeprom_update_float((float*)distanceMaxAddress, val);
-            }
-            else if (id == CMD_ID_TRIGGER_SENSOR) { 
-                // Get max sensor value from buffer and write to EEPROM
-                get_content_bytes(buffer, content_buffer);
-                float val = bytes_to_float(content_buffer);
-                #if TEMPSENSOR
-                maxTemperature = val;
-                #else
-                maxLightIntensity = val;
-                #endif
-                eeprom_update_float((float*)triggerMaxAddress, val);
-            }
-            else {
-                // Not a valid command, set error flags
-                set_error_flag(buffer, ERR_INVALID);
-            }
-        }
-        // Send response
-        if ((buffer[0] & ERR_MASK) == ERR_VALID) {
-            buffer[1] = 0xff;
-            transmit_byte_stream(buffer, 2);
-        }
+    fixed_to_bytes(*command_field(command), content_buffer);
+    set_content_bytes(content_buffer, buffer);
+    return 6;
+}
+
+//Write a threshold and store the settings in eeprom
+unsigned char write_field(unsigned char* buffer, const Command* command)
+{
+    unsigned char content_buffer[4];
+
+    get_content_bytes(buffer, content_buffer);
+    fixed_t val = bytes_to_fixed(content_buffer);
+    *command_field(command) = val;
+    config_save(&settings);
+
+    buffer[1] = 0xff;
+    return 2;
+}
+
+//Reply with the current state
+unsigned char read_status(unsigned char* buffer, const Command* command)
+{
+    unsigned char content_buffer[4];
+
+    (void) command;
+
+    long_to_bytes(currentState, content_buffer);
+    set_content_bytes(content_buffer, buffer);
+    return 6;
+}
+
+//Reply with the UUID and the type of the active sensor
+unsigned char read_uuid(unsigned char* buffer, const Command* command)
+{
+    unsigned char content_buffer[4];
+
+    (void) command;
+
+    memcpy(content_buffer, serial, sizeof(serial));
+    content_buffer[3] = sensors[active_sensor()].type;
+    set_content_bytes(content_buffer, buffer);
+    return 6;
+}
+
+//Select the sensor of the trigger sensor commands, it is only stored in eeprom when the host asks for it
+unsigned char write_sensor(unsigned char* buffer, const Command* command)
+{
+    (void) command;
+
+    if(buffer[1] >= SENSOR_COUNT){
+        set_error_flag(buffer, ERR_INVALID);
+        return 0;
     }
-    // Check if function is read
-    else if (function == CMD_READ) { 
-        // Check if value is current value
-        if (value == CMD_MODE_VALUE) { 
-            // Check if id is status
-            if (id == CMD_ID_STATUS) {
-                // Get current status and write to content buffer
-                float_to_bytes(currentState, content_buffer);
-                set_content_bytes(content_buffer, buffer);
-            }
-            //Checks if id is distance
-            else if (id == CMD_ID_DISTANCE) {
-                // Gets the current distance and write it to content buffer
-                float_to_bytes(distance, content_buffer);
-                set_content_bytes(content_buffer, buffer);
-            }
-            // Check if id is sensor
-            else if (id == CMD_ID_TRIGGER_SENSOR) {
-                // Get current sensor value and write it to content buffer
-                #if TEMPSENSOR
-                float_to_bytes(temperature, content_buffer);
-                #else
-                float_to_bytes(lightIntensity, content_buffer);
-                #endif
-                set_content_bytes(content_buffer, buffer);
-            }
-            // Check if id is UUID/TYPE
-            else if (id == CMD_ID_UUID) {
-                // Get the UUID and write it to content buffer
-                set_content_bytes(serial, buffer);
-            }
-            else {
-                // Not a valid command, set error flags
-                set_error_flag(buffer, ERR_INVALID);
-            }
-        }
-        // Check if value is min
-        else if (value == CMD_MODE_MIN) { 
-            // Check if id is distance
-            if (id == CMD_ID_DISTANCE) { 
-                // Get min distance value and write to content buffer
-                float_to_bytes(minDistance, content_buffer);
-                set_content_bytes(content_buffer, buffer);
-            }
-            // Check if id is sensor
-            else if (id == CMD_ID_TRIGGER_SENSOR) { 
-                // Get min sensor value and write content buffer
-                #if TEMPSENSOR
-                float_to_bytes(minTemperature, content_buffer);
-                #else
-                float_to_bytes(minLightIntensity, content_buffer);
-                #endif
-                set_content_bytes(content_buffer, buffer);
-            }
-            else {
-                // Not a valid command, set error flags
-                set_error_flag(buffer, ERR_INVALID);
-            }
-        }
-        // Check if value is max
-        else if (value == CMD_MODE_MAX) { 
-            // Check if id is distance
-            if (id == CMD_ID_DISTANCE) {
-                // Get max distance and write to content buffer
-                float_to_bytes(maxDistance, content_buffer);
-                set_content_bytes(content_buffer, buffer);
-            }
-            // Check if id is sensor
-            else if (id == CMD_ID_TRIGGER_SENSOR) {
-                // Get max sensor value and write content buffer
-                #if TEMPSENSOR
-                float_to_bytes(maxTemperature, content_buffer);
-                #else
-                float_to_bytes(maxLightIntensity, content_buffer);
-                #endif
-                set_content_bytes(content_buffer, buffer);
-            }
-            else {
-                // Not a valid command, set error flags
-                set_error_flag(buffer, ERR_INVALID);
-            }
-        }
-        // Send reply
-        if((buffer[0] & ERR_MASK) == ERR_VALID) {
-            transmit_byte_stream(buffer, 6);
+
+    selectedSensor = buffer[1];
+
+    //Switching back and forth between the sensors does not wear the eeprom
+    if(buffer[2] == SENSOR_STORE && settings.selected != buffer[1]){
+        settings.selected = buffer[1];
+        config_save(&settings);
+    }
+
+    //Push the values of the newly selected sensor to a subscribed dashboard
+    subscription.pending = 1;
+
+    buffer[1] = 0xff;
+    return 2;
+}
+
+//Reply with the UUID in the discovery slot of the bus address, stations outside the window stay silent
+unsigned char read_discover(unsigned char* buffer, const Command* command)
+{
+    if(!serial_bus_slot(buffer[1])){
+        return 0;
+    }
+    return read_uuid(buffer, command);
+}
+
+//Set the bus address and store it in eeprom, the reply still goes out from the old address
+unsigned char write_address(unsigned char* buffer, const Command* command)
+{
+    (void) command;
+
+    if(!serial_set_address(buffer[1])){
+        set_error_flag(buffer, ERR_INVALID);
+        return 0;
+    }
+
+    settings.address = buffer[1];
+    config_save(&settings);
+
+    //The pushes of a subscription would only be dropped on the bus
+    if(settings.address != 0){
+        subscription.mask = 0;
+    }
+
+    buffer[1] = 0xff;
+    return 2;
+}
+
+unsigned char read_batch(unsigned char* buffer, const Command* command);
+unsigned char write_subscription(unsigned char* buffer, const Command* command);
+unsigned char write_rate(unsigned char* buffer, const Command* command);
+unsigned char read_task_stats(unsigned char* buffer, const Command* command);
+unsigned char read_history(unsigned char* buffer, const Command* command);
+
+//The command table indexed by the function, value and id bits of the command byte, empty entries are invalid commands
+static const Command commands[CMD_COUNT] PROGMEM = {
+    [CMD_INDEX(CMD_READ | CMD_MODE_VALUE | CMD_ID_STATUS)] = {read_status, 0},
+    [CMD_INDEX(CMD_READ | CMD_MODE_VALUE | CMD_ID_DISTANCE)] = {read_field, &distance},
+    [CMD_INDEX(CMD_READ | CMD_MODE_VALUE | CMD_ID_TRIGGER_SENSOR)] = {read_field, &sensorValues[0], sizeof(fixed_t)},
+    [CMD_INDEX(CMD_READ | CMD_MODE_VALUE | CMD_ID_UUID)] = {read_uuid, 0},
+    [CMD_INDEX(CMD_READ | CMD_MODE_MIN | CMD_ID_DISTANCE)] = {read_field, &settings.distanceMin},
+    [CMD_INDEX(CMD_READ | CMD_MODE_MIN | CMD_ID_TRIGGER_SENSOR)] = {read_field, &settings.sensors[0].min, sizeof(SensorLimits)},
+    [CMD_INDEX(CMD_READ | CMD_MODE_MAX | CMD_ID_DISTANCE)] = {read_field, &settings.distanceMax},
+    [CMD_INDEX(CMD_READ | CMD_MODE_MAX | CMD_ID_TRIGGER_SENSOR)] = {read_field, &settings.sensors[0].max, sizeof(SensorLimits)},
+    [CMD_INDEX(CMD_EXT_BATCH)] = {read_batch, 0},
+#if SCH_STATS
+    [CMD_INDEX(CMD_EXT_TASK_STATS)] = {read_task_stats, 0},
+#endif
+    [CMD_INDEX(CMD_EXT_HISTORY)] = {read_history, 0},
+    [CMD_INDEX(CMD_EXT_DISCOVER)] = {read_discover, 0},
+    [CMD_INDEX(CMD_WRITE | CMD_MODE_MIN | CMD_ID_DISTANCE)] = {write_field, &settings.distanceMin},
+    [CMD_INDEX(CMD_WRITE | CMD_MODE_MIN | CMD_ID_TRIGGER_SENSOR)] = {write_field, &settings.sensors[0].min, sizeof(SensorLimits)},
+    [CMD_INDEX(CMD_WRITE | CMD_MODE_MAX | CMD_ID_DISTANCE)] = {write_field, &settings.distanceMax},
+    [CMD_INDEX(CMD_WRITE | CMD_MODE_MAX | CMD_ID_TRIGGER_SENSOR)] = {write_field, &settings.sensors[0].max, sizeof(SensorLimits)},
+    [CMD_INDEX(CMD_EXT_SUBSCRIBE)] = {write_subscription, 0},
+    [CMD_INDEX(CMD_EXT_RATE)] = {write_rate, 0},
+    [CMD_INDEX(CMD_EXT_SENSOR)] = {write_sensor, 0},
+    [CMD_INDEX(CMD_EXT_ADDRESS)] = {write_address, 0},
+};
+
+//The read commands of the batch fields, in the order of the batch field flags
+static const unsigned char batchFields[8] PROGMEM = {
+    CMD_READ | CMD_MODE_VALUE | CMD_ID_STATUS,
+    CMD_READ | CMD_MODE_VALUE | CMD_ID_DISTANCE,
+    CMD_READ | CMD_MODE_VALUE | CMD_ID_TRIGGER_SENSOR,
+    CMD_READ | CMD_MODE_MIN | CMD_ID_DISTANCE,
+    CMD_READ | CMD_MODE_MAX | CMD_ID_DISTANCE,
+    CMD_READ | CMD_MODE_MIN | CMD_ID_TRIGGER_SENSOR,
+    CMD_READ | CMD_MODE_MAX | CMD_ID_TRIGGER_SENSOR,
+    CMD_READ | CMD_MODE_VALUE | CMD_ID_UUID,
+};
+
+//Send a frame with all fields selected by the mask as reply or push, returns 0 when it did not fit in the transmit queue
+unsigned char send_batch(unsigned char raw_command, unsigned char mask, unsigned char push)
+{
+    unsigned char reply[BATCH_MAX_SIZE];
+    unsigned char field[6];
+    Command fieldCommand;
+    unsigned char size = 2;
+
+    //The frame starts with the command byte and the field mask
+    reply[0] = raw_command;
+    reply[1] = mask;
+
+    //Append the content bytes of every selected field
+    for(unsigned char i = 0; i < 8; i++){
+        if(mask & (1 << i)){
+            memcpy_P(&fieldCommand, &commands[CMD_INDEX(pgm_read_byte(&batchFields[i]))], sizeof(Command));
+            fieldCommand.handler(field, &fieldCommand);
+            get_content_bytes(field, &reply[size]);
+            size += 4;
         }
     }
-    else {
+    reply[size] = CMD_STOP;
+    size++;
+
+    return transmit_frame(reply, size, push);
+}
+
+//Reply with all fields selected by the parameter byte in a single frame
+unsigned char read_batch(unsigned char* buffer, const Command* command)
+{
+    (void) command;
+
+    send_batch(buffer[0], buffer[1], 0);
+    return 0;
+}
+
+#if SCH_STATS
+//Reply with the execution statistics of a scheduler task
+unsigned char read_task_stats(unsigned char* buffer, const Command* command)
+{
+    unsigned char reply[TASK_STATS_SIZE];
+    sTaskStats stats;
+
+    (void) command;
+
+    //Copy the statistics of the task, an empty slot is an invalid command
+    if(!SCH_Get_Stats(buffer[1] & ~TASK_STATS_RESET, &stats, buffer[1] & TASK_STATS_RESET)){
+        set_error_flag(buffer, ERR_INVALID);
+        return 0;
+    }
+
+    reply[0] = buffer[0];
+    reply[1] = buffer[1];
+    long_to_bytes(stats.Runs ? (long) stats.ExecMin * SCH_US_PER_COUNT : 0, &reply[2]);
+    long_to_bytes((long) stats.ExecMax * SCH_US_PER_COUNT, &reply[6]);
+    long_to_bytes(stats.Runs ? stats.ExecTotal * SCH_US_PER_COUNT / stats.Runs : 0, &reply[10]);
+    long_to_bytes((long) stats.JitterMax * SCH_US_PER_COUNT, &reply[14]);
+    long_to_bytes(stats.Missed, &reply[18]);
+    long_to_bytes(stats.BacklogMax, &reply[22]);
+    reply[26] = CMD_STOP;
+
+    transmit_frame(reply, TASK_STATS_SIZE, 0);
+    return 0;
+}
+#endif
+
+//Stream the sample history, the dump sends its own frame over the next ticks
+unsigned char read_history(unsigned char* buffer, const Command* command)
+{
+    (void) command;
+
+    history_dump_start(buffer[0], buffer[1]);
+    return 0;
+}
+
+//Set the telemetry subscription from the content bytes, a station on a bus is polled and does not push
+unsigned char write_subscription(unsigned char* buffer, const Command* command)
+{
+    (void) command;
+
+    if(settings.address != 0){
+        set_error_flag(buffer, ERR_INVALID);
+        return 0;
+    }
+
+    subscription.mask = buffer[1];
+    subscription.period = buffer[2];
+    subscription.distanceDeadband = buffer[3];
+    subscription.triggerDeadband = buffer[4];
+
+    //Push the current values right away so the dashboard starts from a known snapshot
+    subscription.counter = 0;
+    subscription.pending = 1;
+
+    buffer[1] = 0xff;
+    return 2;
+}
+
+//Switch the link rate, the reply is sent at the old rate and the new rate falls back when the host does not follow
+unsigned char write_rate(unsigned char* buffer, const Command* command)
+{
+    (void) command;
+
+    if(!serial_set_rate(buffer[1])){
+        set_error_flag(buffer, ERR_INVALID);
+        return 0;
+    }
+
+    buffer[1] = 0xff;
+    return 2;
+}
+
+//Execute a command and send the reply
+void execute(unsigned char* buffer) 
+{
+    Command command;
+    unsigned char size = 0;
+
+    //Look up the command in the command table
+    memcpy_P(&command, &commands[CMD_INDEX(buffer[0])], sizeof(Command));
+
+    if(command.handler == 0){
         // Not a valid command, set error flags
         set_error_flag(buffer, ERR_INVALID);
+        return;
+    }
+
+    //A request that names its sensor leaves the selection of the other clients alone
+    requestSensor = serial_sensor();
+    if(requestSensor != FRAME_SENSOR_NONE && requestSensor >= SENSOR_COUNT){
+        requestSensor = FRAME_SENSOR_NONE;
+        set_error_flag(buffer, ERR_INVALID);
+        return;
+    }
+
+    //Run the command handler, the pushes after it use the selected sensor again
+    size = command.handler(buffer, &command);
+    requestSensor = FRAME_SENSOR_NONE;
+
+    //Send reply, handlers with a larger reply send it themselves and return 0
+    if((buffer[0] & ERR_MASK) == ERR_VALID && size > 0) {
+        transmit_frame(buffer, size, 0);
     }
 }
 
@@ -270,12 +424,17 @@ void parse_command() {
     //Protocol buffer
     unsigned char buffer[6] = {};
 
-    //Check for recieving commands
-    receive_command(buffer);
-    
-    //Check if the command was valid so far
-    if((buffer[0] & ERR_MASK) == ERR_VALID) {
-        execute(buffer);
+    //Handle every command that has been received since the last tick, commands
+    //stay in the receive buffer until the transmit queue has room for the reply
+    //and a running history dump has been sent
+    while(!history_dump() && serial_tx_free() >= REPLY_MAX_SIZE && receive_command(buffer)) {
+        //Check if the command was valid so far
+        if((buffer[0] & ERR_MASK) == ERR_VALID) {
+            execute(buffer);
+        }
+
+        //Clear the buffer for the next command
+        memset(buffer, 0, sizeof(buffer));
     }
 }
 
@@ -285,29 +444,34 @@ void update_state()
     //Counter for the Blinking LED in the Transitioning state
     static int counter = 0;
     
-    //The min, max and currecnt values of the trigger sensor
-    float triggerMin = 0;
-    float triggerMax = 0;
-    float currentVal = 0;
-
-//Set the appropriate sensor data depending on the type of sensor
-#if TEMPSENSOR
-    triggerMax = maxTemperature;
-    triggerMin = minTemperature;
-    currentVal = temperature;
-#else
-    triggerMax = maxLightIntensity;
-    triggerMin = minLightIntensity;
-    currentVal = lightIntensity;
-#endif
+    //The amount of sensors with limits and how many of them are at their max or min
+    unsigned char triggers = 0;
+    unsigned char above = 0;
+    unsigned char below = 0;
+
+    //Compare every sensor with limits to its max and min
+    for(unsigned char i = 0; i < SENSOR_COUNT; i++){
+        const SensorLimits* limits = &settings.sensors[i];
+        fixed_t currentVal = sensorValues[i];
+
+        if(limits->min == 0 || limits->max == 0){
+            continue;
+        }
+        triggers++;
+        if(currentVal >= limits->max){
+            above++;
+        }else if(currentVal <= limits->min){
+            below++;
+        }
+    }
 
     //Check if the arduino has been installed
-    if(triggerMin != 0 && triggerMax != 0 && maxDistance != 0 && minDistance != 0){
-        //Check the state constraint
-        if(currentVal >= triggerMax && currentState != ROLLED_DOWN){
+    if(triggers != 0 && settings.distanceMax != 0 && settings.distanceMin != 0){
+        //Roll down when any sensor reached its max, roll up when all sensors reached their min
+        if(above != 0 && currentState != ROLLED_DOWN){
             currentState = TRANSITIONING;
             direction = 1;
-        }else if(currentVal <= triggerMin && currentState != ROLLED_UP){
+        }else if(above == 0 && below == triggers && currentState != ROLLED_UP){
             currentState = TRANSITIONING;
             direction = -1;
         }
@@ -346,9 +510,9 @@ void update_state()
             counter++;
 
             //Check the distance from the ultrasonor and change state accordingly
-            if(distance > maxDistance && direction > 0){
+            if(distance > settings.distanceMax && direction > 0){
                 currentState = ROLLED_DOWN;
-            }else if(distance < minDistance && direction < 0){
+            }else if(distance < settings.distanceMin && direction < 0){
                 currentState = ROLLED_UP;
             }
             break;
@@ -362,49 +526,109 @@ void update_state()
     }
 }
 
-//Update the distance with latest know sensordata
+//Update the distance with latest know sensordata, runs as soon as a measurement ended
 void update_distance() {
-    //Get the distance from the ultrasound sensor
-    distance = get_distance();
+    fixed_t measured;
+
+    //Get the distance from the ultrasound sensor, a measurement without enough agreeing pings keeps the last distance
+    if(get_distance(&measured) >= DISTANCE_CONFIDENCE){
+        distance = measured;
+    }
 }
 
 //Run the ultrasound sensor process
 void ultrasonor_task(){
-    //Trigger the ultrasonor sensor
+    //Trigger the ultrasonor sensor, update_distance runs when the echo is in
     trigger_ultrasonor();
-
-    //Run oneshot task to update the distance
-    SCH_Add_Task(update_distance,40,0);
 }
 
-//Update and collect the trigger sensordata
+//Update and collect the data of every sensor
 void triggersensor_task() {
-#if TEMPSENSOR
-    //Update the temperature in celsius
-    temperature = getDegreesInCelsius();
-#else
-    //Update the lightintensity
-    lightIntensity = readLightSensor();
-#endif
+    for(unsigned char i = 0; i < SENSOR_COUNT; i++){
+        sensorValues[i] = sensors[i].convert(filter_update(&sensorFilters[i], sensors[i].read()));
+    }
 }
 
+//Check if a value moved further than the deadband since the last push
+unsigned char outside_deadband(fixed_t value, fixed_t last, unsigned char deadband)
+{
+    long change = (long) value - last;
+
+    if(deadband == SUBSCRIBE_DEADBAND_OFF){
+        return 0;
+    }
+    if(change < 0){
+        change = -change;
+    }
+    return change > (long) deadband * FIXED_ONE;
+}
+
+//Add the current values to the sample history
+void history_task()
+{
+    fixed_t values[HISTORY_VALUES];
+
+    values[0] = distance;
+    for(unsigned char i = 0; i < SENSOR_COUNT; i++){
+        values[1 + i] = sensorValues[i];
+    }
+    history_add(values);
+}
+
+//Push the subscribed telemetry when the period expired or a value changed by more than its deadband
+void telemetry_task()
+{
+    fixed_t currentDistance = distance;
+    fixed_t currentTrigger = sensorValues[selectedSensor];
+
+    //Check if there is a subscription
+    if(subscription.mask == 0){
+        return;
+    }
+
+    //Check the push period
+    subscription.counter++;
+    if(subscription.period != 0 && subscription.counter >= subscription.period){
+        subscription.pending = 1;
+    }
+
+    //Report by exception when a value leaves its deadband
+    if(outside_deadband(currentDistance, subscription.lastDistance, subscription.distanceDeadband) ||
+       outside_deadband(currentTrigger, subscription.lastTrigger, subscription.triggerDeadband)){
+        subscription.pending = 1;
+    }
+
+    //Push the frame, when the transmit queue is full or a history dump runs the push is retried on the next run
+    if(subscription.pending && !history_dump() && send_batch(CMD_EXT_BATCH, subscription.mask, 1)){
+        subscription.pending = 0;
+        subscription.counter = 0;
+        subscription.lastDistance = currentDistance;
+        subscription.lastTrigger = currentTrigger;
+    }
+}
+
+//pio test builds the firmware with the main() of a test
+#ifndef PIO_UNIT_TESTING
 int main(){
     //Initialize the program
     initialize();
     
-    //Create all the tasks
-    SCH_Add_Task(parse_command, 0, 1);
-    SCH_Add_Task(update_state, 0, 1);
+    //Create all the tasks, the stop decision goes first when several tasks are ready
+    SCH_Set_Priority(SCH_Add_Task(update_state, 0, 1), PRIORITY_STATE);
+    SCH_Set_Priority(SCH_Add_Task(parse_command, 0, 1), PRIORITY_COMMAND);
     SCH_Add_Task(ultrasonor_task, 0, 40);
     SCH_Add_Task(triggersensor_task, 0, 10);
+    SCH_Add_Task(telemetry_task, 5, TELEMETRY_PERIOD);
+    SCH_Add_Task(history_task, 7, HISTORY_TICKS);
 
     //Start the scheduler (enable global interupts)
     SCH_Start();
 
     //Main loop
     while(1) { 
-        //Task dispatching
+        //Task dispatching, sleeps until the next interrupt when no task is ready
         SCH_Dispatch_Tasks();
     }
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -1,21 +1,110 @@
 #include "pa_io.h"
+#include "avr/interrupt.h"
+#include "util/atomic.h"
+
+static const unsigned char adcChannels[ADC_CHANNEL_COUNT] = ADC_CHANNELS;  //The sampled channels in conversion order
+static volatile unsigned short adcSamples[ADC_CHANNEL_COUNT];              //The latest oversampled sample of every channel
+static volatile unsigned char adcIndex = 0;                                //The channel of the running conversion
+static unsigned short adcSum = 0;                                          //The sum of the conversions of the current sample
+static unsigned char adcCount = 0;                                         //The amount of conversions in the sum
+static unsigned char adcRound = 0;                                         //The amount of rounds over the channels since the bandgap was sampled
+
+//Run a single conversion and wait for the result, only used before the background sampling starts
+static unsigned short adc_convert(unsigned char channel)
+{
+    ADMUX = (ADMUX & 0xF0)|channel;
+
+    ADCSRA |= (1<<ADSC);
+    while(ADCSRA & (1<<ADSC));
+    return (ADC);
+}
 
 //Initialize the ADC
 void adc_init()
 {
     ADMUX = (1<<REFS0);
     ADCSRA = (1<<ADEN)|(1<<ADPS2)|(1<<ADPS1)|(1<<ADPS0);
+
+    //Fill the sample buffers so the first reads have a value
+    for(unsigned char i = 0; i < ADC_CHANNEL_COUNT; i++){
+        adcSamples[i] = adc_convert(adcChannels[i]) << ADC_OVERSAMPLE_BITS;
+    }
+
+    //Timer0 in CTC mode, its compare match starts the conversions, the timer interrupts stay off.
+    //Every conversion wakes the CPU from idle for ADC_vect, so the rate is the lowest that still gives
+    //triggersensor_task a new sample of every sensor per run. ADC noise reduction sleep would stop
+    //timer 1 and with it the scheduler tick, so the conversions run in idle mode.
+    TCCR0A = (1<<WGM01);
+    OCR0A = ADC_TRIGGER_TOP;
+    TCNT0 = 0;
+    TCCR0B = (1<<CS02);
+
+    //Select the first channel and convert on every compare match
+    adcIndex = 0;
+    adcSum = 0;
+    adcCount = 0;
+    ADMUX = (ADMUX & 0xF0)|adcChannels[0];
+    TIFR0 = (1<<OCF0A);
+    ADCSRB = (1<<ADTS1)|(1<<ADTS0);
+    ADCSRA |= (1<<ADATE)|(1<<ADIE);
 }
 
 //Analog read from the ADC
 unsigned short analogRead(unsigned char channel)
 {
-    channel &= 0b00000111;  
-    ADMUX = (ADMUX & 0xF8)|channel;    
- 
-    ADCSRA |= (1<<ADSC);
-    while(ADCSRA & (1<<ADSC));
-    return (ADC);
+    return analogReadOversampled(channel) >> ADC_OVERSAMPLE_BITS;
+}
+
+//Analog read from the ADC with the extra bits of the oversampling
+unsigned short analogReadOversampled(unsigned char channel)
+{
+    unsigned short sample = 0;
+
+    for(unsigned char i = 0; i < ADC_CHANNEL_COUNT; i++){
+        if(adcChannels[i] == channel){
+            ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+                sample = adcSamples[i];
+            }
+        }
+    }
+    return sample;
+}
+
+//Read the supply voltage from the bandgap reference
+unsigned short readSupplyVoltage()
+{
+    unsigned short bandgap = analogReadOversampled(ADC_CHANNEL_BANDGAP);
+
+    return bandgap ? ADC_BANDGAP_SCALE / bandgap : 0;
+}
+
+//The interrupt service routine for a completed conversion, adds it to the sample and moves to the next channel when the sample is complete
+ISR(ADC_vect)
+{
+    adcSum += ADC;
+    adcCount++;
+
+    //Decimate, the sum of 4^n conversions shifted right by n has n extra bits of resolution
+    if(adcCount == ADC_OVERSAMPLE_COUNT){
+        adcSamples[adcIndex] = adcSum >> ADC_OVERSAMPLE_BITS;
+        adcSum = 0;
+        adcCount = 0;
+
+        adcIndex = (adcIndex + 1 < ADC_CHANNEL_COUNT) ? adcIndex + 1 : 0;
+
+        //Skip the bandgap in most rounds
+        if(adcChannels[adcIndex] == ADC_CHANNEL_BANDGAP){
+            if(++adcRound < ADC_BANDGAP_ROUNDS){
+                adcIndex = (adcIndex + 1 < ADC_CHANNEL_COUNT) ? adcIndex + 1 : 0;
+            }else{
+                adcRound = 0;
+            }
+        }
+        ADMUX = (ADMUX & 0xF0)|adcChannels[adcIndex];
+    }
+
+    //Clear the compare flag, the next compare match only starts a conversion on a rising flag
+    TIFR0 = (1<<OCF0A);
 }
 
 // write value to pin for portb
@@ -0,0 +1,9 @@
+#include "sensor.h"
+#include "lightsensor.h"
+#include "tempsensor.h"
+
+//The sensor registry, a new sensor adds its descriptor, index and limits in the config
+const Sensor sensors[SENSOR_COUNT] = {
+    [SENSOR_LIGHT] = {readLightSensor, toLightIntensity, 0},
+    [SENSOR_TEMPERATURE] = {readTempSensor, toDegreesInCelsius, 1},
+};
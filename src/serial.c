@@ -1,96 +1,500 @@
 #include "serial.h"
 #include "pa_io.h"
+#include <stdio.h>
 #include <string.h>
 #include "util/delay.h"
+#include <avr/interrupt.h>
+#include "util/atomic.h"
+#include "util/crc16.h"
+
+typedef enum{
+    FRAME_IDLE,     // Waiting for a command byte
+    FRAME_CONTENT,  // Reading the content bytes of a write command
+    FRAME_STOP,     // Waiting for the stop byte
+    FRAME_V2        // Reading the escaped payload of a v2 or bus frame
+} FrameState; // State of the incremental frame parser
+
+static volatile unsigned char rx_buffer[RX_BUFFER_SIZE]; // Bytes received by the USART_RX_vect interrupt
+static volatile unsigned char rx_head = 0;              // Next write position, only changed by the interrupt
+static volatile unsigned char rx_tail = 0;              // Next read position, only changed by receive_command
+static volatile unsigned char rx_overflow = 0;          // Set when a byte was dropped because the ring buffer was full
+
+static volatile unsigned char tx_buffer[TX_BUFFER_SIZE]; // Bytes waiting for the USART_UDRE_vect interrupt
+static volatile unsigned char tx_head = 0;              // Next write position, only changed by transmit_byte_stream
+static volatile unsigned char tx_tail = 0;              // Next read position, only changed by the interrupt
+static unsigned int tx_dropped = 0;                     // Amount of bytes dropped because the queue was full
+
+static const unsigned char rates[SERIAL_RATE_COUNT] = SERIAL_RATES; // The UBRR0 values of the selectable rates
+static unsigned char rate_requested = 0;                // The rate index plus one of a rate command whose reply has not been queued yet, 0 for none
+static volatile unsigned char rate_pending = 0;         // The rate index plus one to switch to when the transmitter is done, 0 for none
+static volatile unsigned char rate_timeout = 0;         // Amount of receive_command calls left for a valid frame at a new rate, 0 once it is confirmed
+
+static FrameState frame_state = FRAME_IDLE;             // The parser state
+static unsigned char frame[10];                         // The frame that is being received, v2 frames with address, sequence number, sensor index and CRC
+static unsigned char frame_index = 0;                   // Amount of bytes received of the current frame
+static unsigned char frame_expected = 0;                // Amount of content bytes of the current frame
+static unsigned char frame_idle = 0;                    // Amount of receive_command calls without new bytes for the current frame
+static unsigned char frame_escape = 0;                  // Set when the last v2 byte was FRAME_ESC
+static unsigned char frame_overrun = 0;                 // Set when a v2 frame did not fit the frame buffer
+static unsigned char frame_bus = 0;                     // Set when the v2 frame is a bus frame
+
+static unsigned char rx_v2 = 0;                         // Set when the last valid request was a v2 frame
+static unsigned char rx_seq = 0;                        // The sequence number of the last v2 request
+static unsigned char rx_bus = 0;                        // Set when the last valid request was a bus frame
+static unsigned char rx_sensor = FRAME_SENSOR_NONE;     // The sensor index of the last valid request
+static unsigned char rx_address = 0;                    // The address that answers the last bus request
+static unsigned char tx_v2 = 0;                         // Set while a v2 frame is being queued
+static unsigned char tx_bus = 0;                        // Set while a bus frame is being queued
+static unsigned short tx_crc = 0;                       // The CRC of the v2 frame that is being queued
+
+static unsigned char bus_address = 0;                   // The bus address of the station, 0 when it is not on a bus
+static unsigned short bus_slot = 0;                     // The discovery slot delay of the next reply in bus timer periods
+static volatile unsigned short bus_wait = 0;            // Bus timer periods left before the held bytes are sent, 0 when none are held
+static volatile unsigned char bus_driving = 0;          // Set while the station drives the bus
+static volatile unsigned char bus_open = 0;             // Set from frame_begin of a bus frame until its end is queued, the bus stays driven meanwhile
+
+// Returns the amount of content bytes that follow a command byte
+static unsigned char content_length(unsigned char command)
+{
+    if (command & CMD_WRITE) {
+        return 4; // 32 bit value
+    }
+    if ((command & CMD_VALUE_MASK) == CMD_MODE_EXTENDED) {
+        return 1; // Parameter byte
+    }
+    return 0;
+}
+
+// Set the baud rate divider of a rate, the USART runs at double speed for a finer table
+static void set_rate(unsigned char index)
+{
+    UBRR0H = 0;
+    UBRR0L = rates[index];
+}
+
+// Arm a requested rate switch once the reply to the rate command is queued, nothing is queued after it
+static void rate_arm()
+{
+    if (rate_requested) {
+        rate_pending = rate_requested;
+        rate_requested = 0;
+    }
+}
+
+// Start sending the queued bytes, a bus frame first waits for the turnaround when the station does not drive the bus yet
+static void tx_start()
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        // Bytes queued during the wait go out with the held bytes
+        if (!bus_wait) {
+            if (tx_bus && !bus_driving) {
+                // Timer 2 in normal mode with a prescaler of 64 overflows every 1.024 ms
+                bus_wait = BUS_TURNAROUND + bus_slot;
+                TCNT2 = 0;
+                TIMSK2 = _BV(TOIE2);
+                TCCR2B = _BV(CS22);
+            }
+            else {
+                UCSR0B |= _BV(UDRIE0);
+            }
+        }
+    }
+    bus_slot = 0;
+}
 
 // Initialize serial communication
 void serial_init()
 {
     // Initialize UART
-    UBRR0H = 0;
-    UBRR0L = UBBRVAL;
-    UCSR0A = 0;
-    UCSR0B = _BV(TXEN0) | _BV(RXEN0);
+    set_rate(SERIAL_RATE_DEFAULT);
+    UCSR0A = _BV(U2X0);
+    UCSR0B = _BV(TXEN0) | _BV(RXEN0) | _BV(RXCIE0);
     UCSR0C = _BV(UCSZ01) | _BV(UCSZ00);
+
+    // Release the bus, the bus timer stays off until a reply waits for the turnaround
+    DDRD |= _BV(BUS_DE_PIN);
+    PORTD &= ~_BV(BUS_DE_PIN);
+    TCCR2A = 0;
 }
 
-// Transmit a byte
-void transmit(unsigned char data)
+// Transmit a byte, returns 0 when the transmit queue is full and the byte was dropped
+unsigned char transmit(unsigned char data)
 {
-    loop_until_bit_is_set(UCSR0A, UDRE0);
-    UDR0 = data;
+    return transmit_byte_stream(&data, 1);
 }
 
 // Transmit a string
-void transmit_string(unsigned char *str)
+unsigned char transmit_string(unsigned char *str)
 {
-    for (int i = 0; i < strlen(str); i++) {
-        transmit(str[i]);
+    return transmit_byte_stream(str, strlen((const char*) str));
+}
+
+// Queue a stream of bytes for the USART_UDRE_vect interrupt, the stream is only queued when it fits as a whole
+unsigned char transmit_byte_stream(unsigned char *buffer, int size)
+{
+    unsigned char head = tx_head;
+    unsigned char chunk = 0;
+
+    // Report back-pressure instead of waiting for the queue to drain
+    if (size > serial_tx_free()) {
+        tx_dropped += size;
+        return 0;
+    }
+
+    // Copy the stream into the queue, split in two when it wraps around the end
+    chunk = TX_BUFFER_SIZE - head;
+    if (chunk > size) {
+        chunk = size;
     }
+    memcpy((unsigned char*) &tx_buffer[head], buffer, chunk);
+    memcpy((unsigned char*) tx_buffer, buffer + chunk, size - chunk);
+    tx_head = (head + size) & (TX_BUFFER_SIZE - 1);
+
+    // Start the interrupt driven transmission
+    rate_arm();
+    tx_start();
+    return 1;
+}
+
+// Queue a byte without checking the free space, the caller checked it
+static void tx_put(unsigned char data)
+{
+    tx_buffer[tx_head] = data;
+    tx_head = (tx_head + 1) & (TX_BUFFER_SIZE - 1);
 }
 
-// Transmit a stream of bytes
-void transmit_byte_stream(unsigned char *buffer, int size)
+// Returns the amount of bytes a v2 payload byte takes on the line
+static unsigned char escaped_size(unsigned char data)
 {
-    for (int i = 0; i < size; i++) {
-        transmit(buffer[i]);
+    return (data == FRAME_END || data == FRAME_ESC) ? 2 : 1;
+}
+
+// Queue a v2 payload byte, escaping the bytes that delimit a frame
+static void tx_put_escaped(unsigned char data)
+{
+    if (data == FRAME_END || data == FRAME_ESC) {
+        tx_put(FRAME_ESC);
+        data = (data == FRAME_END) ? FRAME_ESC_END : FRAME_ESC_ESC;
     }
+    tx_put(data);
 }
 
-// Receive a command
-void receive_command(unsigned char *buffer)
+// Queue a complete v1 frame that ends with the stop byte, as v2 frame when the last request was one
+unsigned char transmit_frame(unsigned char *buffer, int size, unsigned char push)
 {
-    // Initialize values
-    int i = 0;
-    int expected_cont_bytes = 0;
-    unsigned char packet = 0;
+    unsigned short crc = 0xFFFF;
+    unsigned char seq = push ? FRAME_PUSH_SEQ : rx_seq;
+    int needed = 0;
+
+    // Stations on a bus only answer requests, the host polls them instead
+    if (push && bus_address) {
+        return 1;
+    }
+    if (!rx_v2) {
+        return transmit_byte_stream(buffer, size);
+    }
+
+    // The frame is only queued when it fits as a whole, like a v1 frame
+    if (rx_bus) {
+        crc = _crc16_update(crc, rx_address);
+        needed += escaped_size(rx_address);
+    }
+    crc = _crc16_update(crc, seq);
+    needed += 2 + escaped_size(seq);
+    for (int i = 0; i < size - 1; i++) {
+        crc = _crc16_update(crc, buffer[i]);
+        needed += escaped_size(buffer[i]);
+    }
+    needed += escaped_size(crc) + escaped_size(crc >> 8);
+    if (needed > serial_tx_free()) {
+        tx_dropped += needed;
+        return 0;
+    }
+
+    frame_begin(push);
+    frame_append(buffer, size - 1);
+    return frame_end();
+}
+
+// Start a frame, the framing stays the same until frame_end even when a request of the other framing arrives
+unsigned char frame_begin(unsigned char push)
+{
+    unsigned char seq = push ? FRAME_PUSH_SEQ : rx_seq;
+
+    tx_v2 = rx_v2;
+    tx_bus = rx_bus;
+    if (!tx_v2) {
+        return 1;
+    }
+    if (1 + (tx_bus ? escaped_size(rx_address) : 0) + escaped_size(seq) > serial_tx_free()) {
+        return 0;
+    }
 
-    // Read the first byte from the UART
-    if (UCSR0A & (1 << RXC0)) {
-        // Sets the packet value to received byte
-        packet = UDR0;
+    // A bus frame starts with the address of the station, the bus is not released when the queue runs empty before its end
+    tx_crc = 0xFFFF;
+    bus_open = tx_bus;
+    if (tx_bus) {
+        tx_put(FRAME_SYNC_BUS);
+        tx_put_escaped(rx_address);
+        tx_crc = _crc16_update(tx_crc, rx_address);
     }
     else {
-        // Sets the error flags of the first byte
-        buffer[0] |= ERR_INVALID;
-        return;
+        tx_put(FRAME_SYNC);
     }
+    tx_put_escaped(seq);
+    tx_crc = _crc16_update(tx_crc, seq);
+    tx_start();
+    return 1;
+}
+
+// Queue as much frame content as fits, the caller queues the rest later
+unsigned char frame_append(unsigned char *buffer, unsigned char size)
+{
+    unsigned char free_bytes = serial_tx_free();
+    unsigned char count = 0;
 
-    // Check if the first byte is a write command
-    if (packet & CMD_WRITE) {
-        // Set the expected amount of content bytes to 4
-        expected_cont_bytes = 4; // 32 bit value
+    if (!tx_v2) {
+        if (size > free_bytes) {
+            size = free_bytes;
+        }
+        return transmit_byte_stream(buffer, size) ? size : 0;
     }
 
-    buffer[i] = packet;
-    i++;
+    while (count < size && escaped_size(buffer[count]) <= free_bytes) {
+        free_bytes -= escaped_size(buffer[count]);
+        tx_crc = _crc16_update(tx_crc, buffer[count]);
+        tx_put_escaped(buffer[count]);
+        count++;
+    }
+    if (count > 0) {
+        tx_start();
+    }
+    return count;
+}
 
-    int time_out = 0;
-    // Read until expected amount of bytes is reached or stop byte is received
-    while (1) {
-        if (UCSR0A & (1 << RXC0)) {
-            packet = UDR0;
-            if (i > expected_cont_bytes) {
-                if (packet == CMD_STOP) {
-                    buffer[i] = packet;
+// End a frame with the stop byte or with the CRC and FRAME_END
+unsigned char frame_end()
+{
+    if (!tx_v2) {
+        return transmit(CMD_STOP);
+    }
+    if (escaped_size(tx_crc) + escaped_size(tx_crc >> 8) + 1 > serial_tx_free()) {
+        return 0;
+    }
+
+    tx_put_escaped(tx_crc);
+    tx_put_escaped(tx_crc >> 8);
+    tx_put(FRAME_END);
+    bus_open = 0; // Only once the end is queued, the queue is not empty until it is sent
+    rate_arm();
+    tx_start();
+    return 1;
+}
+
+// Returns the amount of bytes that still fit in the transmit queue, nothing fits from the reply to a rate command until the switch
+unsigned char serial_tx_free()
+{
+    if (rate_pending) {
+        return 0;
+    }
+    return (tx_tail - tx_head - 1) & (TX_BUFFER_SIZE - 1);
+}
+
+// Switch the rate after the queued bytes, the reply to the rate command still goes out at the old rate
+unsigned char serial_set_rate(unsigned char index)
+{
+    if (index >= SERIAL_RATE_COUNT) {
+        return 0;
+    }
+    rate_requested = index + 1;
+    return 1;
+}
+
+// Returns the amount of bytes dropped because the transmit queue was full
+unsigned int serial_tx_dropped()
+{
+    return tx_dropped;
+}
+
+// Take the bus frames of an address from now on, the reply to the request that set it still uses the old address
+unsigned char serial_set_address(unsigned char address)
+{
+    if (address > BUS_ADDRESS_MAX) {
+        return 0;
+    }
+    bus_address = address;
+    return 1;
+}
+
+// Delay the next reply by the discovery slot of the address, the slots are in address order from the first address of the window
+unsigned char serial_bus_slot(unsigned char first)
+{
+    unsigned char slot = bus_address - first;
+
+    if (bus_address == BUS_BROADCAST || bus_address < first || slot >= BUS_SLOTS) {
+        return 0;
+    }
+    bus_slot = (unsigned short) slot * BUS_SLOT;
+    return 1;
+}
+
+// Returns the sensor index the last request carried after its content, a v1 request never carries one
+unsigned char serial_sensor()
+{
+    return rx_sensor;
+}
+
+// Receive a command, feeds all buffered bytes through the frame parser without blocking
+unsigned char receive_command(unsigned char *buffer)
+{
+    unsigned char packet = 0;
+
+    while (rx_tail != rx_head) {
+        // Take the next byte from the ring buffer
+        packet = rx_buffer[rx_tail];
+        rx_tail = (rx_tail + 1) & (RX_BUFFER_SIZE - 1);
+        frame_idle = 0;
+
+        switch (frame_state) {
+            case FRAME_IDLE:
+                // Start a v2 or bus frame
+                if (packet == FRAME_SYNC_BUS || (packet == FRAME_SYNC && !bus_address)) {
+                    frame_index = 0;
+                    frame_escape = 0;
+                    frame_overrun = 0;
+                    frame_bus = (packet == FRAME_SYNC_BUS);
+                    frame_state = FRAME_V2;
+                    break;
+                }
+
+                // Stations on a bus only take bus frames, the other bytes are skipped
+                if (bus_address) {
                     break;
                 }
+
+                // Start a new frame
+                frame[0] = packet;
+                frame_index = 1;
+                frame_expected = content_length(packet);
+                frame_state = frame_expected ? FRAME_CONTENT : FRAME_STOP;
+                break;
+
+            case FRAME_CONTENT:
+                frame[frame_index] = packet;
+                frame_index++;
+                if (frame_index > frame_expected) {
+                    frame_state = FRAME_STOP;
+                }
+                break;
+
+            case FRAME_STOP:
+                // The frame is complete, copy it to the caller
+                frame_state = FRAME_IDLE;
+                memcpy(buffer, frame, frame_index);
+                if (packet == CMD_STOP) {
+                    buffer[frame_index] = packet;
+                    rate_timeout = 0; // The host talks at the current rate
+                    rx_v2 = 0;
+                    rx_bus = 0;
+                    rx_sensor = FRAME_SENSOR_NONE;
+                }
                 else {
                     buffer[0] |= ERR_UNEXPECTED_BYTE_COUNT;
+                }
+                if (rx_overflow) {
+                    rx_overflow = 0;
+                    buffer[0] |= ERR_DATA_LOSS;
+                }
+                return 1;
+
+            case FRAME_V2:
+                if (packet != FRAME_END) {
+                    // Store the unescaped byte, a frame that is too long is dropped at its end
+                    if (packet == FRAME_ESC) {
+                        frame_escape = 1;
+                        break;
+                    }
+                    if (frame_escape) {
+                        frame_escape = 0;
+                        packet = (packet == FRAME_ESC_END) ? FRAME_END : (packet == FRAME_ESC_ESC) ? FRAME_ESC : packet;
+                    }
+                    if (frame_index < sizeof(frame)) {
+                        frame[frame_index++] = packet;
+                    }
+                    else {
+                        frame_overrun = 1;
+                    }
                     break;
                 }
-            }
-            buffer[i] = packet;
-            i++;
+
+                // The frame is complete, drop it when the length or the CRC is wrong, a sensor index may follow the content
+                frame_state = FRAME_IDLE;
+                unsigned char header = frame_bus ? 2 : 1; // Address and sequence number
+                if (frame_overrun || frame_index < header + 3) {
+                    break;
+                }
+                unsigned char length = 1 + content_length(frame[header]); // The command byte and its content
+                if (frame_index - header - 2 != length && frame_index - header - 2 != length + 1) {
+                    break;
+                }
+                unsigned short crc = 0xFFFF;
+                for (unsigned char i = 0; i < frame_index - 2; i++) {
+                    crc = _crc16_update(crc, frame[i]);
+                }
+                if (frame[frame_index - 2] != (unsigned char) crc || frame[frame_index - 1] != (unsigned char) (crc >> 8)) {
+                    break;
+                }
+
+                // Drop the bus frames of other stations, a broadcast is only taken for a discovery
+                if (frame_bus && (bus_address == BUS_BROADCAST || (frame[0] != bus_address &&
+                    (frame[0] != BUS_BROADCAST || frame[2] != CMD_EXT_DISCOVER)))) {
+                    break;
+                }
+
+                // Copy the v1 frame to the caller and answer in the framing of the request
+                memcpy(buffer, &frame[header], length);
+                buffer[length] = CMD_STOP;
+                rx_seq = frame[header - 1];
+                rx_v2 = 1;
+                rx_bus = frame_bus;
+                rx_sensor = (frame_index - header - 2 > length) ? frame[header + length] : FRAME_SENSOR_NONE;
+                rx_address = bus_address;
+                rate_timeout = 0;
+                if (rx_overflow) {
+                    rx_overflow = 0;
+                    buffer[0] |= ERR_DATA_LOSS;
+                }
+                return 1;
         }
-        else {
-            time_out++;
-            if (time_out == 10000) {
-                buffer[0] |= ERR_UNEXPECTED_BYTE_COUNT;
-                break;
+    }
+
+    // Drop a partial frame when the rest of it does not arrive in time
+    if (frame_state != FRAME_IDLE) {
+        frame_idle++;
+        if (frame_idle == RX_FRAME_TIMEOUT) {
+            // A v2 frame is dropped without a reply, the host repeats the sequence number it misses
+            if (frame_state == FRAME_V2) {
+                frame_state = FRAME_IDLE;
+                buffer[0] |= ERR_INVALID;
+                return 0;
             }
+            frame_state = FRAME_IDLE;
+            buffer[0] = frame[0] | ERR_UNEXPECTED_BYTE_COUNT;
+            return 1;
         }
     }
+
+    // Fall back when no valid frame arrives at a new rate, the host may not have followed
+    if (rate_timeout) {
+        rate_timeout--;
+        if (rate_timeout == 0) {
+            set_rate(SERIAL_RATE_DEFAULT);
+        }
+    }
+
+    // No complete frame available, set the error flags of the first byte
+    buffer[0] |= ERR_INVALID;
+    return 0;
 }
 
 // Copies all the values of the source buffer to byte 1 .. 4 of destination buffer
@@ -123,39 +527,152 @@ void set_error_flag(unsigned char *buffer, unsigned char error)
     buffer[5] = 0x00;
 }
 
-// Converts a byte array to an IEEE floating point value
-float bytes_to_float(unsigned char *bytes)
+// Encodes magnitude * 2^-shift as an IEEE single precision value, bits below the 24 bit mantissa are truncated
+static void encode_float(unsigned long magnitude, unsigned char negative, signed char shift, unsigned char *buffer)
 {
-    union {
-        float float_value;
-        unsigned char byte_values[4];
-    } float_byte_u;
+    unsigned long bits = 0;
+    int exponent = 150 - shift;
 
-    float_byte_u.byte_values[0] = bytes[0];
-    float_byte_u.byte_values[1] = bytes[1];
-    float_byte_u.byte_values[2] = bytes[2];
-    float_byte_u.byte_values[3] = bytes[3];
+    if (magnitude != 0) {
+        // Normalize the mantissa so the leading one is bit 23
+        while (magnitude >= (1UL << 24)) {
+            magnitude >>= 1;
+            exponent++;
+        }
+        while (magnitude < (1UL << 23)) {
+            magnitude <<= 1;
+            exponent--;
+        }
+        bits = ((unsigned long) exponent << 23) | (magnitude & 0x7FFFFFUL);
+    }
+    if (negative) {
+        bits |= 1UL << 31;
+    }
+
+    // The dashboard expects the bytes in little endian order
+    buffer[0] = bits;
+    buffer[1] = bits >> 8;
+    buffer[2] = bits >> 16;
+    buffer[3] = bits >> 24;
+}
+
+// Converts a byte array with an IEEE floating point value to fixed point, rounding to nearest and saturating
+fixed_t bytes_to_fixed(unsigned char *bytes)
+{
+    unsigned long bits = (unsigned long) bytes[0] | ((unsigned long) bytes[1] << 8) |
+                         ((unsigned long) bytes[2] << 16) | ((unsigned long) bytes[3] << 24);
+    unsigned char exponent = (bits >> 23) & 0xFF;
+    unsigned long magnitude = (bits & 0x7FFFFFUL) | (1UL << 23);
+    int shift = 146 - exponent; // value * 2^FIXED_FRAC_BITS = mantissa >> (150 - FIXED_FRAC_BITS - exponent)
+
+    // Zero, denormals and NaN have no fixed point value
+    if (exponent == 0 || (exponent == 0xFF && (bits & 0x7FFFFFUL))) {
+        return 0;
+    }
+
+    if (shift >= 25) {
+        magnitude = 0;
+    }
+    else if (shift > 0) {
+        magnitude = (magnitude + (1UL << (shift - 1))) >> shift;
+    }
+    else {
+        // Too large for the fixed point range, infinity included
+        magnitude = (unsigned long) FIXED_MAX + 1;
+    }
 
-    return float_byte_u.float_value;
+    if (magnitude > FIXED_MAX) {
+        return (bits >> 31) ? FIXED_MIN : FIXED_MAX;
+    }
+    return (bits >> 31) ? -(fixed_t) magnitude : (fixed_t) magnitude;
 }
 
-// Converts an IEEE floating point value to a byte array
-void float_to_bytes(float value, unsigned char *buffer)
+// Converts a fixed point value to a byte array with an IEEE floating point value
+void fixed_to_bytes(fixed_t value, unsigned char *buffer)
 {
-    union {
-        float float_value;
-        unsigned char byte_values[4];
-    } float_byte_u;
+    long magnitude = value;
 
-    float_byte_u.float_value = value;
+    encode_float(magnitude < 0 ? -magnitude : magnitude, magnitude < 0, FIXED_FRAC_BITS, buffer);
+}
 
-    memcpy(buffer, float_byte_u.byte_values, sizeof(float_byte_u.byte_values));
+// Converts an integer to a byte array with an IEEE floating point value
+void long_to_bytes(long value, unsigned char *buffer)
+{
+    encode_float(value < 0 ? -(unsigned long) value : (unsigned long) value, value < 0, 0, buffer);
 }
 
 // Transmits a debug value over the serial connection
 void debug_transmit(int value)
 {
     unsigned char buffer[10];
-    sprintf(buffer, "%d", value);
+    sprintf((char*) buffer, "%d", value);
     transmit_string(buffer);
+}
+
+// The interrupt service routine for a received byte, stores the byte in the ring buffer
+ISR(USART_RX_vect)
+{
+    unsigned char data = UDR0;
+    unsigned char next = (rx_head + 1) & (RX_BUFFER_SIZE - 1);
+
+    if (next != rx_tail) {
+        rx_buffer[rx_head] = data;
+        rx_head = next;
+    }
+    else {
+        rx_overflow = 1;
+    }
+}
+
+// The interrupt service routine for an empty data register, sends the next queued byte
+ISR(USART_UDRE_vect)
+{
+    if (tx_head != tx_tail) {
+        // A rate switch and the bus release wait for the end of this byte, clear TXC0 of the previous bytes by writing a one
+        if (rate_pending || bus_driving) {
+            UCSR0A = (UCSR0A & _BV(U2X0)) | _BV(TXC0);
+        }
+        UDR0 = tx_buffer[tx_tail];
+        tx_tail = (tx_tail + 1) & (TX_BUFFER_SIZE - 1);
+    }
+
+    // Disable the interrupt when the queue is empty, a rate switch and the bus release follow once the last byte is out
+    if (tx_head == tx_tail) {
+        UCSR0B &= ~_BV(UDRIE0);
+        if (rate_pending || bus_driving) {
+            UCSR0B |= _BV(TXCIE0);
+        }
+    }
+}
+
+// The interrupt service routine for a completed transmission, releases the bus and switches to the negotiated rate
+ISR(USART_TX_vect)
+{
+    UCSR0B &= ~_BV(TXCIE0);
+
+    // Keep driving the bus when bytes were queued since the queue ran empty or the frame has more to come
+    if (bus_driving && tx_head == tx_tail && !bus_open) {
+        PORTD &= ~_BV(BUS_DE_PIN);
+        bus_driving = 0;
+    }
+    if (!rate_pending) {
+        return;
+    }
+    set_rate(rate_pending - 1);
+
+    // The default rate always works, any other rate needs a valid frame before the timeout
+    rate_timeout = (rate_pending - 1 == SERIAL_RATE_DEFAULT) ? 0 : SERIAL_RATE_TIMEOUT;
+    rate_pending = 0;
+}
+
+// The interrupt service routine of the bus timer, drives the bus and sends the held bytes once the wait is over
+ISR(TIMER2_OVF_vect)
+{
+    if (--bus_wait == 0) {
+        TCCR2B = 0;
+        TIMSK2 = 0;
+        PORTD |= _BV(BUS_DE_PIN);
+        bus_driving = 1;
+        UCSR0B |= _BV(UDRIE0);
+    }
 }
\ No newline at end of file
@@ -3,19 +3,23 @@
 
 //Read the raw sensor data of the temperature sensor
 int readTempSensor(){
-    return analogRead(TEMP_SENSOR_PIN_A);
+    return analogReadOversampled(TEMP_SENSOR_PIN_A);
+}
+
+//Convert raw sensor data to degrees in celcius
+fixed_t toDegreesInCelsius(int raw){
+    //(adc * 5 / 4096 - 0.5) * 100 degrees, scaled by 16 for the fixed point fraction
+    long adcRes = raw;
+    return ((adcRes * 125) >> 6) - FIXED_FROM_INT(50);
 }
 
 //Read the temperature in celcius
-float getDegreesInCelsius(){
-    float adcRes = readTempSensor();
-    adcRes *= 5;
-    adcRes /= 1024.0;
-    return (adcRes - 0.5) * 100;
+fixed_t getDegreesInCelsius(){
+    return toDegreesInCelsius(readTempSensor());
 }
 
 //Read the temperature in fahrenheit
-float getDegreesInFahrenheit(){
-    float tempInC = getDegreesInCelsius();
-    return (tempInC * 9.0 / 5.0) + 32.0;
+fixed_t getDegreesInFahrenheit(){
+    long tempInC = getDegreesInCelsius();
+    return (tempInC * 9 / 5) + FIXED_FROM_INT(32);
 }
\ No newline at end of file
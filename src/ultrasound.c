@@ -1,70 +1,172 @@
 #include "ultrasound.h"
 #include "pa_io.h"
 #include <avr/interrupt.h>
-#include "util/delay.h"
+#include "util/atomic.h"
+#include "AVR_TTC_scheduler.h"
 
-static volatile unsigned long pulse = 0;            //The pulse duration on the echo pin
-static volatile int i = 0;                          //The state of the pulse on the echo pin
-static volatile unsigned long timerOverflow = 0;    //The amount of overflows during the echo pulse
+typedef enum{
+    ECHO_IDLE,
+    ECHO_TRIGGER,
+    ECHO_RUNNING,
+    ECHO_GAP
+} EchoState; //The state of a measurement
+
+static unsigned int burstSamples[ULTRASOUND_BURST]; //The echo durations of the accepted pings in timer 1 counts
+static volatile unsigned char burstCount = 0;       //The amount of accepted pings in the burst
+static unsigned char burstPings = 0;                //The amount of pings sent in the burst
+static volatile unsigned int echoStart = 0;         //The timer 1 count at the rising edge of the echo
+static volatile EchoState echoState = ECHO_IDLE;    //The state of the running measurement
+static unsigned char echoReadyTask = SCH_MAX_TASKS; //The event task that is signaled when a measurement ends
 
 //Setup the ultrasonor
-void setup_ultrasound()
+void setup_ultrasound(unsigned char readyTask)
+{
+    echoReadyTask = readyTask;
+
+    //Set the trigger pin to output and the echo pin to input
+    DDRB |= (1 << ULTRASOUND_TRIGGER_PIN);
+    DDRB &= ~(1 << ULTRASOUND_ECHO_PIN);
+
+    //Timer 1 runs for the scheduler, use the noise canceler on its input capture
+    TCCR1B |= (1 << ICNC1);
+}
+
+//Send a 12 microsecond pulse to the sensor, called with interrupts disabled
+static void send_ping()
 {
-    //Set pin 4 to output and set pin 2 (INT0) to input
-    DDRD |=  (1 << PORTD4);
-    DDRD &=  ~(1 << PORTD2);
-    PORTD |= (1 << PORTD2);
+    //Raise the trigger pin by forcing a compare match in set mode
+    TCCR1A |= (1 << COM1B1) | (1 << COM1B0);
+    TCCR1C = (1 << FOC1B);
 
-    //Set the interupt mask to enable the INT0 interupt
-    EIMSK |= (1 << INT0);
-    EICRA |= (1 << ISC00);
+    //The next compare match lowers it again, there is no need to wait
+    OCR1B = TCNT1 + ULTRASOUND_TRIGGER_COUNTS;
+    TCCR1A &= ~(1 << COM1B0);
+    echoState = ECHO_TRIGGER;
+    burstPings++;
 
-    //Set the TCCR2A register for timer 2 for default behaviour
-    TCCR2A = 0;
+    //Capture the rising edge of the echo, the end of the pulse starts the timeout
+    TCCR1B |= (1 << ICES1);
+    TIFR1 = (1 << ICF1) | (1 << OCF1B);
+    TIMSK1 |= (1 << ICIE1) | (1 << OCIE1B);
 }
 
-//Triger the ultrasonor by sending a 12 microsecond pulse to the sensor
+//Triger the ultrasonor for a burst of pings
 void trigger_ultrasonor()
 {
-    PORTD |= (1<<PIND4);
-    _delay_us(12);
-    PORTD &= ~(1<<PIND4);
+    //Let the running measurement end first
+    if(echoState != ECHO_IDLE){
+        return;
+    }
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        burstPings = 0;
+        burstCount = 0;
+        send_ping();
+    }
+}
+
+//End a ping, keep the echo when it is in range and wait for the next ping or signal the ready task
+static void end_ping(unsigned int ticks)
+{
+    TIMSK1 &= ~(1 << ICIE1);
+
+    //Timeouts (0) and echoes outside the range of the sensor are rejected
+    if(ticks >= ULTRASOUND_MIN_COUNTS && ticks <= ULTRASOUND_MAX_COUNTS){
+        burstSamples[burstCount] = ticks;
+        burstCount++;
+    }
+
+    if(burstPings < ULTRASOUND_BURST){
+        //Let the reflections of this ping die out before the next one, after a timeout the sensor may still hold the echo high
+        OCR1B = TCNT1 + (ticks ? ULTRASOUND_GAP_COUNTS : ULTRASOUND_LOST_GAP_COUNTS);
+        echoState = ECHO_GAP;
+    }else{
+        TIMSK1 &= ~(1 << OCIE1B);
+        echoState = ECHO_IDLE;
+        SCH_Signal_Task(echoReadyTask);
+    }
 }
 
-//Calculate the distance based on pulse duration
-unsigned long get_distance()
+//Calculate the distance based on the median pulse duration of the burst
+unsigned char get_distance(fixed_t* distance)
 {
-    return pulse / 58 / 16;
+    unsigned int sorted[ULTRASOUND_BURST];
+    unsigned char count;
+    unsigned char agree = 0;
+    unsigned int median;
+    unsigned long cm;
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+        count = burstCount;
+        for(unsigned char i = 0; i < count; i++){
+            sorted[i] = burstSamples[i];
+        }
+    }
+    if(count == 0){
+        return 0;
+    }
+
+    //Insertion sort, the burst is only a few pings
+    for(unsigned char i = 1; i < count; i++){
+        unsigned int ticks = sorted[i];
+        unsigned char j = i;
+
+        while(j > 0 && sorted[j - 1] > ticks){
+            sorted[j] = sorted[j - 1];
+            j--;
+        }
+        sorted[j] = ticks;
+    }
+    median = sorted[count / 2];
+
+    //The confidence is the share of all pings that agree with the median
+    for(unsigned char i = 0; i < count; i++){
+        if(sorted[i] + ULTRASOUND_AGREE_COUNTS >= median && sorted[i] <= median + ULTRASOUND_AGREE_COUNTS){
+            agree++;
+        }
+    }
+
+    //Multiply and shift instead of dividing, keeping the fraction bits of the fixed point result
+    cm = ((unsigned long) median * ULTRASOUND_CM_SCALE) >> (16 - FIXED_FRAC_BITS);
+    *distance = cm > FIXED_MAX ? FIXED_MAX : cm;
+    return agree * 100 / ULTRASOUND_BURST;
 }
 
-//The interupt service routine for INT0
-ISR(INT0_vect)
+//The interupt service routine for the input capture of timer 1
+ISR(TIMER1_CAPT_vect)
 {
-    if (i == 1) //Check if state is high
+    if (TCCR1B & (1 << ICES1)) //Check if this is the rising edge
     {
-        //Reset the timer and set the pulse
-        TCCR2B = 0;
-        pulse = TCNT2 + (timerOverflow * 256);
-        TCNT2 = 0;
-        TIFR2 = 1 << TOV2;
-        TIMSK2 = 0;
-        i = 0;
+        //Store the start and capture the falling edge, changing the edge can raise the flag
+        echoStart = ICR1;
+        TCCR1B &= ~(1 << ICES1);
+        TIFR1 = (1 << ICF1);
     }
-    if (i == 0) //Check if state is low
+    else
     {
-        //Enable the timer
-        TIFR2 = 1 << TOV2;
-        timerOverflow = 0;
-        TIMSK2 = 1 << TOIE2;   		
-        TCCR2B |= (1 << CS10);
-      
-        i = 1;
+        //The echo is complete
+        end_ping((uint16_t)(ICR1 - echoStart));
     }
 }
 
-//The interupt service routinge for the overflow vector of timer2
-ISR(TIMER2_OVF_vect)
+//The interupt service routine for the compare match B of timer 1
+ISR(TIMER1_COMPB_vect)
 {
-    //Increment the amount of overflows
-	timerOverflow++;	
-}
\ No newline at end of file
+    if (echoState == ECHO_TRIGGER) //Check if the trigger pulse ended
+    {
+        //Release the pin and give the echo until the timeout
+        TCCR1A &= ~((1 << COM1B1) | (1 << COM1B0));
+        OCR1B += ULTRASOUND_TIMEOUT_COUNTS;
+        echoState = ECHO_RUNNING;
+    }
+    else if (echoState == ECHO_RUNNING)
+    {
+        //No complete echo in time
+        end_ping(0);
+    }
+    else
+    {
+        //The gap after the previous ping is over
+        send_ping();
+    }
+}
@@ -0,0 +1,165 @@
+// Tests of the conversion between the IEEE floats of the protocol and fixed point, the host floats are little endian like the frames
+
+#include <unity.h>
+#include "avrsim.h"
+#include "serial.h"
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+// The fixed point value of a float in protocol byte order
+static fixed_t to_fixed(float value)
+{
+    unsigned char bytes[4];
+
+    memcpy(bytes, &value, sizeof(bytes));
+    return bytes_to_fixed(bytes);
+}
+
+// The fixed point value of the raw bits of a float
+static fixed_t bits_to_fixed(uint32_t bits)
+{
+    unsigned char bytes[4] = {bits, bits >> 8, bits >> 16, bits >> 24};
+
+    return bytes_to_fixed(bytes);
+}
+
+// The fixed point value of the float next to a float towards zero
+static fixed_t below_to_fixed(float value)
+{
+    uint32_t bits;
+
+    memcpy(&bits, &value, sizeof(bits));
+    return bits_to_fixed(bits - 1);
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+// Half an LSB rounds away from zero, anything below it rounds to the nearer value
+void test_rounding_at_half_lsb(void)
+{
+    TEST_ASSERT_EQUAL_INT16(1, to_fixed(1.0f / 32));
+    TEST_ASSERT_EQUAL_INT16(-1, to_fixed(-1.0f / 32));
+    TEST_ASSERT_EQUAL_INT16(0, below_to_fixed(1.0f / 32));
+    TEST_ASSERT_EQUAL_INT16(0, below_to_fixed(-1.0f / 32));
+    TEST_ASSERT_EQUAL_INT16(2, to_fixed(3.0f / 32));
+    TEST_ASSERT_EQUAL_INT16(-2, to_fixed(-3.0f / 32));
+    TEST_ASSERT_EQUAL_INT16(FIXED_FROM_INT(100) + 1, to_fixed(100.0f + 1.0f / 32));
+    TEST_ASSERT_EQUAL_INT16(FIXED_FROM_INT(100), below_to_fixed(100.0f + 1.0f / 32));
+}
+
+// Values too small for the resolution are 0
+void test_underflow(void)
+{
+    TEST_ASSERT_EQUAL_INT16(0, to_fixed(1e-10f));
+    TEST_ASSERT_EQUAL_INT16(0, to_fixed(-1e-10f));
+    TEST_ASSERT_EQUAL_INT16(0, to_fixed(FLT_MIN));
+}
+
+// The range ends at 2047.9375 and -2048, larger magnitudes saturate
+void test_saturation_at_2048(void)
+{
+    TEST_ASSERT_EQUAL_INT16(FIXED_MAX, to_fixed(2047.9375f));
+    TEST_ASSERT_EQUAL_INT16(FIXED_MAX, to_fixed(2047.97f));
+    TEST_ASSERT_EQUAL_INT16(FIXED_MAX, to_fixed(2048.0f));
+    TEST_ASSERT_EQUAL_INT16(FIXED_MIN + 1, to_fixed(-2047.9375f));
+    TEST_ASSERT_EQUAL_INT16(FIXED_MIN, to_fixed(-2047.97f));
+    TEST_ASSERT_EQUAL_INT16(FIXED_MIN, to_fixed(-2048.0f));
+    TEST_ASSERT_EQUAL_INT16(FIXED_MIN, to_fixed(-2049.0f));
+}
+
+// From exponent 146 on the shift is no longer positive, the value saturates whatever its mantissa
+void test_saturation_above_exponent_146(void)
+{
+    TEST_ASSERT_EQUAL_INT16(FIXED_MAX, bits_to_fixed(146UL << 23));
+    TEST_ASSERT_EQUAL_INT16(FIXED_MAX, bits_to_fixed(147UL << 23));
+    TEST_ASSERT_EQUAL_INT16(FIXED_MAX, bits_to_fixed((147UL << 23) | 0x7FFFFF));
+    TEST_ASSERT_EQUAL_INT16(FIXED_MIN, bits_to_fixed(0x80000000UL | (147UL << 23)));
+    TEST_ASSERT_EQUAL_INT16(FIXED_MAX, to_fixed(1e30f));
+    TEST_ASSERT_EQUAL_INT16(FIXED_MAX, to_fixed(FLT_MAX));
+    TEST_ASSERT_EQUAL_INT16(FIXED_MIN, to_fixed(-FLT_MAX));
+}
+
+// Infinities saturate, NaN of either sign is 0
+void test_infinity_and_nan(void)
+{
+    TEST_ASSERT_EQUAL_INT16(FIXED_MAX, to_fixed(INFINITY));
+    TEST_ASSERT_EQUAL_INT16(FIXED_MIN, to_fixed(-INFINITY));
+    TEST_ASSERT_EQUAL_INT16(0, bits_to_fixed(0x7FC00000UL));   // Quiet NaN
+    TEST_ASSERT_EQUAL_INT16(0, bits_to_fixed(0xFFC00000UL));   // Negative quiet NaN
+    TEST_ASSERT_EQUAL_INT16(0, bits_to_fixed(0x7F800001UL));   // Signalling NaN
+    TEST_ASSERT_EQUAL_INT16(0, bits_to_fixed(0x7FFFFFFFUL));
+}
+
+// Denormals are 0
+void test_denormals(void)
+{
+    TEST_ASSERT_EQUAL_INT16(0, bits_to_fixed(0x00000001UL));
+    TEST_ASSERT_EQUAL_INT16(0, bits_to_fixed(0x007FFFFFUL));
+    TEST_ASSERT_EQUAL_INT16(0, bits_to_fixed(0x80000001UL));
+    TEST_ASSERT_EQUAL_INT16(0, bits_to_fixed(0x807FFFFFUL));
+}
+
+// Both zeros are 0, and 0 is sent as +0.0
+void test_zero(void)
+{
+    unsigned char bytes[4];
+    const unsigned char positive_zero[4] = {0, 0, 0, 0};
+
+    TEST_ASSERT_EQUAL_INT16(0, to_fixed(0.0f));
+    TEST_ASSERT_EQUAL_INT16(0, to_fixed(-0.0f));
+    fixed_to_bytes(0, bytes);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(positive_zero, bytes, 4);
+}
+
+// Every fixed point value is sent as its exact float and read back unchanged
+void test_round_trip_of_every_value(void)
+{
+    for (long value = FIXED_MIN; value <= FIXED_MAX; value++) {
+        unsigned char bytes[4];
+        float sent;
+
+        fixed_to_bytes((fixed_t) value, bytes);
+        memcpy(&sent, bytes, sizeof(sent));
+        TEST_ASSERT_EQUAL_FLOAT((float) value / FIXED_ONE, sent);
+        TEST_ASSERT_EQUAL_INT16(value, bytes_to_fixed(bytes));
+    }
+}
+
+// Integers are sent exactly up to 2^24
+void test_long_to_bytes(void)
+{
+    const long values[] = {0, 1, -1, 42, -42, 16777215, -16777216, 16777216};
+
+    for (unsigned char i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        unsigned char bytes[4];
+        float sent;
+
+        long_to_bytes(values[i], bytes);
+        memcpy(&sent, bytes, sizeof(sent));
+        TEST_ASSERT_EQUAL_FLOAT((float) values[i], sent);
+    }
+}
+
+int main(void)
+{
+    avrsim_uart_capture();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_rounding_at_half_lsb);
+    RUN_TEST(test_underflow);
+    RUN_TEST(test_saturation_at_2048);
+    RUN_TEST(test_saturation_above_exponent_146);
+    RUN_TEST(test_infinity_and_nan);
+    RUN_TEST(test_denormals);
+    RUN_TEST(test_zero);
+    RUN_TEST(test_round_trip_of_every_value);
+    RUN_TEST(test_long_to_bytes);
+    return UNITY_END();
+}
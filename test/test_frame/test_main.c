@@ -0,0 +1,333 @@
+// Tests of the v2 and bus framing: escaping, CRC, length checks, sequence numbers of the replies, sensor indexes
+// and the bus driver
+
+#include <unity.h>
+#include "avrsim.h"
+#include "history.h"
+#include "sensor.h"
+#include "serial.h"
+#include "util/crc16.h"
+#include "util/delay.h"
+#include <avr/interrupt.h>
+#include <string.h>
+
+#define BYTE_US 521 // One byte at 19200 baud with U2X0, 10 bits
+
+void initialize();
+void parse_command();
+
+// Append a payload byte, escaping the bytes that delimit a frame
+static size_t put_escaped(unsigned char* out, size_t size, unsigned char data)
+{
+    if (data == FRAME_END || data == FRAME_ESC) {
+        out[size++] = FRAME_ESC;
+        data = (data == FRAME_END) ? FRAME_ESC_END : FRAME_ESC_ESC;
+    }
+    out[size++] = data;
+    return size;
+}
+
+// Build the v2 frame of a v1 frame without its stop byte, returns the frame size
+static size_t encode(unsigned char seq, const unsigned char* v1, size_t v1_size, unsigned char* out)
+{
+    unsigned short crc = _crc16_update(0xFFFF, seq);
+    size_t size = 0;
+
+    out[size++] = FRAME_SYNC;
+    size = put_escaped(out, size, seq);
+    for (size_t i = 0; i < v1_size; i++) {
+        crc = _crc16_update(crc, v1[i]);
+        size = put_escaped(out, size, v1[i]);
+    }
+    size = put_escaped(out, size, crc);
+    size = put_escaped(out, size, crc >> 8);
+    out[size++] = FRAME_END;
+    return size;
+}
+
+// Build the bus frame of a v1 frame without its stop byte for a station address, returns the frame size
+static size_t encode_bus(unsigned char address, unsigned char seq, const unsigned char* v1, size_t v1_size, unsigned char* out)
+{
+    unsigned short crc = _crc16_update(_crc16_update(0xFFFF, address), seq);
+    size_t size = 0;
+
+    out[size++] = FRAME_SYNC_BUS;
+    size = put_escaped(out, size, address);
+    size = put_escaped(out, size, seq);
+    for (size_t i = 0; i < v1_size; i++) {
+        crc = _crc16_update(crc, v1[i]);
+        size = put_escaped(out, size, v1[i]);
+    }
+    size = put_escaped(out, size, crc);
+    size = put_escaped(out, size, crc >> 8);
+    out[size++] = FRAME_END;
+    return size;
+}
+
+// Take the first v2 frame of the sent bytes, checks its framing and CRC and returns the payload size without the CRC
+static size_t decode(const unsigned char* in, size_t in_size, size_t* used, unsigned char* payload)
+{
+    unsigned short crc = 0xFFFF;
+    size_t size = 0;
+    size_t i = 1;
+
+    TEST_ASSERT_TRUE(in_size > 0);
+    TEST_ASSERT_EQUAL_HEX8(FRAME_SYNC, in[0]);
+    for (; i < in_size && in[i] != FRAME_END; i++) {
+        unsigned char data = in[i];
+
+        if (data == FRAME_ESC) {
+            i++;
+            TEST_ASSERT_TRUE(i < in_size);
+            TEST_ASSERT_TRUE(in[i] == FRAME_ESC_END || in[i] == FRAME_ESC_ESC);
+            data = (in[i] == FRAME_ESC_END) ? FRAME_END : FRAME_ESC;
+        }
+        payload[size++] = data;
+    }
+    TEST_ASSERT_TRUE(i < in_size);
+    TEST_ASSERT_TRUE(size >= 3);
+    for (size_t j = 0; j < size - 2; j++) {
+        crc = _crc16_update(crc, payload[j]);
+    }
+    TEST_ASSERT_EQUAL_HEX16(crc, payload[size - 2] | (payload[size - 1] << 8));
+    *used = i + 1;
+    return size - 2;
+}
+
+// Queue bytes on the uart, let the firmware handle them and take what it sends, returns the amount sent
+static size_t exchange(const unsigned char* request, size_t size, unsigned char* reply, size_t reply_size)
+{
+    avrsim_uart_receive(request, size);
+    _delay_us(BYTE_US * (size + 1));
+    parse_command();
+    _delay_ms(50);
+    return avrsim_uart_sent(reply, reply_size);
+}
+
+void setUp(void)
+{
+    avrsim_uart_capture();
+}
+
+void tearDown(void)
+{
+}
+
+// -2.0 is 00 00 00 C0, the value and sequence numbers of FRAME_END and FRAME_ESC are escaped both ways
+void test_round_trip_of_escaped_bytes(void)
+{
+    const unsigned char write[] = {CMD_WRITE | CMD_MODE_MIN | CMD_ID_DISTANCE, 0x00, 0x00, 0x00, 0xC0};
+    const unsigned char read[] = {CMD_READ | CMD_MODE_MIN | CMD_ID_DISTANCE};
+    const unsigned char write_reply[] = {FRAME_ESC, CMD_WRITE | CMD_MODE_MIN | CMD_ID_DISTANCE};
+    const unsigned char read_reply[] = {FRAME_END, CMD_READ | CMD_MODE_MIN | CMD_ID_DISTANCE, 0x00, 0x00, 0x00, 0xC0};
+    unsigned char request[32];
+    unsigned char reply[32];
+    unsigned char payload[32];
+    size_t size;
+    size_t used;
+
+    size = encode(FRAME_ESC, write, sizeof(write), request);
+    TEST_ASSERT_EQUAL_HEX8(FRAME_ESC_ESC, request[2]);
+    TEST_ASSERT_EQUAL_HEX8(FRAME_ESC_END, request[8]);
+    size = exchange(request, size, reply, sizeof(reply));
+    TEST_ASSERT_EQUAL(sizeof(write_reply), decode(reply, size, &used, payload));
+    TEST_ASSERT_EQUAL(size, used);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(write_reply, payload, sizeof(write_reply));
+
+    size = encode(FRAME_END, read, sizeof(read), request);
+    size = exchange(request, size, reply, sizeof(reply));
+    TEST_ASSERT_EQUAL(sizeof(read_reply), decode(reply, size, &used, payload));
+    TEST_ASSERT_EQUAL(size, used);
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(read_reply, payload, sizeof(read_reply));
+}
+
+// A frame with a wrong CRC is dropped without a reply, the next frame is answered
+void test_bad_crc_dropped(void)
+{
+    const unsigned char read[] = {CMD_READ | CMD_MODE_VALUE | CMD_ID_STATUS};
+    unsigned char request[32];
+    unsigned char reply[32];
+    unsigned char payload[32];
+    size_t size;
+    size_t used;
+
+    size = encode(0x11, read, sizeof(read), request);
+    request[size - 2] ^= 0x01;
+    TEST_ASSERT_EQUAL(0, exchange(request, size, reply, sizeof(reply)));
+
+    size = encode(0x12, read, sizeof(read), request);
+    size = exchange(request, size, reply, sizeof(reply));
+    TEST_ASSERT_EQUAL(6, decode(reply, size, &used, payload));
+    TEST_ASSERT_EQUAL_HEX8(0x12, payload[0]);
+}
+
+// A frame with more or fewer content bytes than its command takes is dropped, even with a valid CRC
+void test_wrong_length_rejected(void)
+{
+    const unsigned char long_read[] = {CMD_READ | CMD_MODE_MIN | CMD_ID_DISTANCE, 0x00, 0x00, 0x80, 0x3F};
+    const unsigned char short_write[] = {CMD_WRITE | CMD_MODE_MIN | CMD_ID_DISTANCE, 0x00, 0x00, 0x80};
+    const unsigned char no_parameter[] = {CMD_EXT_BATCH};
+    unsigned char request[32];
+    unsigned char reply[32];
+    size_t size;
+
+    size = encode(0x21, long_read, sizeof(long_read), request);
+    TEST_ASSERT_EQUAL(0, exchange(request, size, reply, sizeof(reply)));
+    size = encode(0x22, short_write, sizeof(short_write), request);
+    TEST_ASSERT_EQUAL(0, exchange(request, size, reply, sizeof(reply)));
+    size = encode(0x23, no_parameter, sizeof(no_parameter), request);
+    TEST_ASSERT_EQUAL(0, exchange(request, size, reply, sizeof(reply)));
+}
+
+// Requests that arrive back to back are answered in order, each reply with the sequence number of its request
+void test_pipelined_requests_in_order(void)
+{
+    const unsigned char reads[][1] = {
+        {CMD_READ | CMD_MODE_VALUE | CMD_ID_STATUS},
+        {CMD_READ | CMD_MODE_MIN | CMD_ID_DISTANCE},
+        {CMD_READ | CMD_MODE_MAX | CMD_ID_DISTANCE},
+        {CMD_READ | CMD_MODE_VALUE | CMD_ID_UUID},
+    };
+    unsigned char request[64];
+    unsigned char reply[64];
+    unsigned char payload[32];
+    size_t size = 0;
+    size_t offset = 0;
+
+    for (unsigned char i = 0; i < 4; i++) {
+        size += encode(0x31 + i, reads[i], 1, request + size);
+    }
+    TEST_ASSERT_TRUE(size <= RX_BUFFER_SIZE);
+    size = exchange(request, size, reply, sizeof(reply));
+
+    for (unsigned char i = 0; i < 4; i++) {
+        size_t used;
+
+        TEST_ASSERT_EQUAL(6, decode(reply + offset, size - offset, &used, payload));
+        TEST_ASSERT_EQUAL_HEX8(0x31 + i, payload[0]);
+        TEST_ASSERT_EQUAL_HEX8(reads[i][0], payload[1]);
+        offset += used;
+    }
+    TEST_ASSERT_EQUAL(size, offset);
+}
+
+// A v1 request after a v2 request gets a v1 reply
+void test_v1_after_v2(void)
+{
+    const unsigned char read[] = {CMD_READ | CMD_MODE_VALUE | CMD_ID_STATUS};
+    const unsigned char v1_read[] = {CMD_READ | CMD_MODE_VALUE | CMD_ID_STATUS, CMD_STOP};
+    unsigned char request[32];
+    unsigned char reply[32];
+    unsigned char payload[32];
+    size_t size;
+    size_t used;
+
+    size = encode(0x41, read, sizeof(read), request);
+    size = exchange(request, size, reply, sizeof(reply));
+    TEST_ASSERT_EQUAL(6, decode(reply, size, &used, payload));
+    TEST_ASSERT_EQUAL_HEX8(0x41, payload[0]);
+
+    TEST_ASSERT_EQUAL(6, exchange(v1_read, sizeof(v1_read), reply, sizeof(reply)));
+    TEST_ASSERT_EQUAL_HEX8(v1_read[0], reply[0]);
+    TEST_ASSERT_EQUAL_HEX8(CMD_STOP, reply[5]);
+}
+
+// A sensor index after the content picks the sensor of that request only, the selected sensor stays in use for the others
+void test_sensor_index_per_request(void)
+{
+    const unsigned char write_light[] = {CMD_WRITE | CMD_MODE_MAX | CMD_ID_TRIGGER_SENSOR, 0x00, 0x00, 0x16, 0x44, SENSOR_LIGHT}; // 600
+    const unsigned char write_temperature[] = {CMD_WRITE | CMD_MODE_MAX | CMD_ID_TRIGGER_SENSOR, 0x00, 0x00, 0xF0, 0x41, SENSOR_TEMPERATURE}; // 30
+    const unsigned char read_temperature[] = {CMD_READ | CMD_MODE_MAX | CMD_ID_TRIGGER_SENSOR, SENSOR_TEMPERATURE};
+    const unsigned char read_selected[] = {CMD_READ | CMD_MODE_MAX | CMD_ID_TRIGGER_SENSOR};
+    const unsigned char uuid_temperature[] = {CMD_READ | CMD_MODE_VALUE | CMD_ID_UUID, SENSOR_TEMPERATURE};
+    const unsigned char read_invalid[] = {CMD_READ | CMD_MODE_MAX | CMD_ID_TRIGGER_SENSOR, SENSOR_COUNT};
+    unsigned char request[32];
+    unsigned char reply[32];
+    unsigned char payload[32];
+    size_t size;
+    size_t used;
+
+    size = encode(0x51, write_light, sizeof(write_light), request);
+    size = exchange(request, size, reply, sizeof(reply));
+    TEST_ASSERT_EQUAL(2, decode(reply, size, &used, payload));
+    size = encode(0x52, write_temperature, sizeof(write_temperature), request);
+    size = exchange(request, size, reply, sizeof(reply));
+    TEST_ASSERT_EQUAL(2, decode(reply, size, &used, payload));
+
+    size = encode(0x53, read_temperature, sizeof(read_temperature), request);
+    size = exchange(request, size, reply, sizeof(reply));
+    TEST_ASSERT_EQUAL(6, decode(reply, size, &used, payload));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(&write_temperature[1], &payload[2], 4);
+
+    size = encode(0x54, read_selected, sizeof(read_selected), request);
+    size = exchange(request, size, reply, sizeof(reply));
+    TEST_ASSERT_EQUAL(6, decode(reply, size, &used, payload));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(&write_light[1], &payload[2], 4);
+
+    size = encode(0x55, uuid_temperature, sizeof(uuid_temperature), request);
+    size = exchange(request, size, reply, sizeof(reply));
+    TEST_ASSERT_EQUAL(6, decode(reply, size, &used, payload));
+    TEST_ASSERT_EQUAL_HEX8(sensors[SENSOR_TEMPERATURE].type, payload[5]);
+
+    size = encode(0x56, read_invalid, sizeof(read_invalid), request);
+    TEST_ASSERT_EQUAL(0, exchange(request, size, reply, sizeof(reply)));
+}
+
+// A history dump on a bus keeps the driver enabled until its end is sent, also when the queue runs empty between two refills
+void test_bus_dump_keeps_driving(void)
+{
+    const unsigned char dump[] = {CMD_EXT_HISTORY, 0};
+    unsigned char request[32];
+    static unsigned char sent[2048];
+    size_t size;
+    unsigned int released = 0;
+
+    for (unsigned int i = 0; i < 150; i++) {
+        fixed_t values[HISTORY_VALUES] = {FIXED_FROM_INT(i % 40), FIXED_FROM_INT(500) + 37 * i, FIXED_FROM_INT(20) - 11 * i};
+
+        history_add(values);
+    }
+    TEST_ASSERT_TRUE(serial_set_address(5));
+    size = encode_bus(5, 0x61, dump, sizeof(dump), request);
+    avrsim_uart_receive(request, size);
+    _delay_us(BYTE_US * (size + 1));
+
+    // A station that is busy with other tasks only refills the queue every 100 ms, the queue drains in 67 ms
+    size = 0;
+    for (unsigned int ms = 0; ms < 5000 && (size == 0 || sent[size - 1] != FRAME_END); ms++) {
+        if (ms % 100 == 0) {
+            parse_command();
+        }
+        _delay_ms(1);
+        size += avrsim_uart_sent(sent + size, sizeof(sent) - size);
+        if (size > 0 && sent[size - 1] != FRAME_END && !(PORTD & _BV(BUS_DE_PIN))) {
+            released++;
+        }
+    }
+    serial_set_address(BUS_BROADCAST);
+
+    TEST_ASSERT_TRUE(size > 2 * TX_BUFFER_SIZE);
+    TEST_ASSERT_EQUAL_HEX8(FRAME_SYNC_BUS, sent[0]);
+    TEST_ASSERT_EQUAL_HEX8(FRAME_END, sent[size - 1]);
+    TEST_ASSERT_EQUAL(0, released);
+
+    // The bus is released once the end is out
+    _delay_ms(5);
+    TEST_ASSERT_FALSE(PORTD & _BV(BUS_DE_PIN));
+}
+
+int main(void)
+{
+    initialize();
+    sei();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_round_trip_of_escaped_bytes);
+    RUN_TEST(test_bad_crc_dropped);
+    RUN_TEST(test_wrong_length_rejected);
+    RUN_TEST(test_pipelined_requests_in_order);
+    RUN_TEST(test_v1_after_v2);
+    RUN_TEST(test_sensor_index_per_request);
+    RUN_TEST(test_bus_dump_keeps_driving);
+    return UNITY_END();
+}
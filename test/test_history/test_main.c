@@ -0,0 +1,215 @@
+// Tests of the sample history, every dump is decoded and compared with the samples that were added
+
+#include <unity.h>
+#include "avrsim.h"
+#include "history.h"
+#include "serial.h"
+#include "util/delay.h"
+#include <avr/interrupt.h>
+#include <string.h>
+
+#define DUMP_MAX (HISTORY_DUMP_HEADER_SIZE + HISTORY_BLOCKS * HISTORY_BLOCK_SIZE + 1) // A v1 dump of every block
+
+typedef struct{
+    fixed_t values[HISTORY_VALUES];
+} Sample;
+
+static Sample added[512];           // Every sample added so far, indexed by sample number
+static unsigned int addedCount = 0;
+static unsigned char frame[DUMP_MAX];
+static unsigned long decodedLast;   // The sample number of the last decoded sample
+
+// Add a sample to the history and to the samples the dumps are compared with
+static void add(fixed_t distance, fixed_t light, fixed_t temperature)
+{
+    Sample* sample = &added[addedCount++];
+
+    sample->values[0] = distance;
+    sample->values[1 + SENSOR_LIGHT] = light;
+    sample->values[1 + SENSOR_TEMPERATURE] = temperature;
+    history_add(sample->values);
+}
+
+// Send a dump of the newest blocks, the transmit queue drains between the calls of history_dump(), returns its size
+static size_t dump(unsigned char blocks, unsigned int* refills)
+{
+    size_t size = 0;
+
+    *refills = 0;
+    history_dump_start(CMD_EXT_HISTORY, blocks);
+    while (history_dump()) {
+        (*refills)++;
+        _delay_ms(20);
+        size += avrsim_uart_sent(frame + size, sizeof(frame) - size);
+    }
+    _delay_ms(100);
+    return size + avrsim_uart_sent(frame + size, sizeof(frame) - size);
+}
+
+// A decoded sample has to be the one added with its number
+static void check_sample(unsigned long number, const fixed_t* values)
+{
+    TEST_ASSERT_TRUE(number < addedCount);
+    TEST_ASSERT_EQUAL_INT16_ARRAY(added[number].values, values, HISTORY_VALUES);
+    decodedLast = number;
+}
+
+// Decode the blocks of a dump frame and check every sample, returns the amount of samples
+static unsigned int check_dump(size_t size, unsigned char blocks)
+{
+    unsigned int length = frame[3] | (frame[4] << 8);
+    size_t offset = HISTORY_DUMP_HEADER_SIZE;
+    unsigned int samples = 0;
+
+    TEST_ASSERT_EQUAL_HEX8(CMD_EXT_HISTORY, frame[0]);
+    TEST_ASSERT_EQUAL(blocks, frame[1]);
+    TEST_ASSERT_EQUAL(HISTORY_PERIOD, frame[2]);
+    TEST_ASSERT_EQUAL(HISTORY_DUMP_HEADER_SIZE + length + 1, size);
+    TEST_ASSERT_EQUAL_HEX8(CMD_STOP, frame[size - 1]);
+
+    for (unsigned char b = 0; b < blocks; b++) {
+        const unsigned char* block = &frame[offset];
+        unsigned char position = HISTORY_HEADER_SIZE;
+        unsigned long number = 0;
+        fixed_t values[HISTORY_VALUES];
+
+        TEST_ASSERT_TRUE(block[0] >= HISTORY_HEADER_SIZE && block[0] <= HISTORY_BLOCK_SIZE);
+        TEST_ASSERT_TRUE(offset + block[0] <= HISTORY_DUMP_HEADER_SIZE + length);
+
+        // The keyframe
+        for (unsigned char i = 0; i < 4; i++) {
+            number |= (unsigned long) block[1 + i] << (8 * i);
+        }
+        for (unsigned char i = 0; i < HISTORY_VALUES; i++) {
+            values[i] = (fixed_t) (block[5 + 2 * i] | (block[6 + 2 * i] << 8));
+        }
+        if (samples > 0) {
+            TEST_ASSERT_TRUE(number > decodedLast);
+        }
+        check_sample(number, values);
+        samples++;
+
+        // The zigzag varint deltas, the sums wrap at 16 bits like the differences did
+        while (position < block[0]) {
+            for (unsigned char i = 0; i < HISTORY_VALUES; i++) {
+                uint16_t zigzag = 0;
+                unsigned char bits = 0;
+
+                do {
+                    TEST_ASSERT_TRUE(position < block[0] && bits < 21);
+                    zigzag |= (uint16_t) (block[position] & 0x7F) << bits;
+                    bits += 7;
+                } while (block[position++] & 0x80);
+                values[i] = (fixed_t) (uint16_t) (values[i] + (int16_t) ((zigzag >> 1) ^ -(zigzag & 1)));
+            }
+            check_sample(++number, values);
+            samples++;
+        }
+        TEST_ASSERT_EQUAL(block[0], position);
+        offset += block[0];
+    }
+    TEST_ASSERT_EQUAL(HISTORY_DUMP_HEADER_SIZE + length, offset);
+    return samples;
+}
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+// Deltas across the whole int16 range take three varint bytes and wrap back to the stored values
+void test_delta_extremes(void)
+{
+    const unsigned char first[] = {
+        HISTORY_HEADER_SIZE + 9, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+        0xFE, 0xFF, 0x03, 0xFF, 0xFF, 0x03, 0xFE, 0xFF, 0x03,
+    };
+    unsigned int refills;
+    size_t size;
+
+    // +32767, -32768 and +32767 again as the first delta
+    add(0, 0, 0);
+    add(FIXED_MAX, FIXED_MIN, FIXED_MAX);
+    size = dump(0, &refills);
+    TEST_ASSERT_EQUAL(2, check_dump(size, 1));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(first, &frame[HISTORY_DUMP_HEADER_SIZE], sizeof(first));
+
+    // Differences beyond the int16 range wrap, FIXED_MAX to FIXED_MIN is a delta of +1
+    add(FIXED_MIN, FIXED_MAX, -1);
+    add(0, 0, FIXED_MAX);
+    add(FIXED_MAX, -1, FIXED_MIN);
+    add(-1, FIXED_MIN, 0);
+    add(FIXED_MIN, FIXED_MAX, FIXED_MIN);
+    size = dump(0, &refills);
+    TEST_ASSERT_EQUAL(addedCount, check_dump(size, frame[1]));
+    TEST_ASSERT_EQUAL(addedCount - 1, decodedLast);
+}
+
+// After 16 full blocks the oldest block is overwritten, the dump starts at the oldest block that is left
+void test_block_rollover(void)
+{
+    unsigned int refills;
+    unsigned int samples;
+    size_t size;
+
+    // One byte deltas, a block takes deltas while the largest sample still fits, a keyframe and 5 deltas
+    for (unsigned int i = 0; i < HISTORY_BLOCKS * 6 + 20; i++) {
+        add(FIXED_FROM_INT(10) + (i & 1), FIXED_FROM_INT(500) - (i % 3), FIXED_FROM_INT(21) + (i % 5));
+    }
+
+    size = dump(0, &refills);
+    samples = check_dump(size, HISTORY_BLOCKS);
+    TEST_ASSERT_EQUAL(addedCount - 1, decodedLast);
+    TEST_ASSERT_TRUE(samples < addedCount);
+    TEST_ASSERT_EQUAL(HISTORY_HEADER_SIZE + 5 * HISTORY_VALUES, frame[HISTORY_DUMP_HEADER_SIZE]);
+
+    // The newest blocks only
+    size = dump(2, &refills);
+    check_dump(size, 2);
+    TEST_ASSERT_EQUAL(addedCount - 1, decodedLast);
+}
+
+// A dump larger than the transmit queue is sent over several refills, a sample added meanwhile is stored after it
+void test_chunked_dump(void)
+{
+    unsigned int refills;
+    unsigned int samples;
+    size_t size = 0;
+
+    history_dump_start(CMD_EXT_HISTORY, 0);
+    for (refills = 0; history_dump(); refills++) {
+        if (refills == 1) {
+            add(FIXED_FROM_INT(-5), FIXED_FROM_INT(1000), FIXED_FROM_INT(-40));
+        }
+        _delay_ms(20);
+        size += avrsim_uart_sent(frame + size, sizeof(frame) - size);
+    }
+    _delay_ms(100);
+    size += avrsim_uart_sent(frame + size, sizeof(frame) - size);
+
+    TEST_ASSERT_TRUE(size > TX_BUFFER_SIZE);
+    TEST_ASSERT_TRUE(refills >= 3);
+    samples = check_dump(size, HISTORY_BLOCKS);
+    TEST_ASSERT_EQUAL(addedCount - 2, decodedLast);
+
+    // The next dump has the sample that arrived during the last one
+    size = dump(0, &refills);
+    TEST_ASSERT_EQUAL(samples + 1, check_dump(size, HISTORY_BLOCKS));
+    TEST_ASSERT_EQUAL(addedCount - 1, decodedLast);
+}
+
+int main(void)
+{
+    avrsim_uart_capture();
+    serial_init();
+    sei();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_delta_extremes);
+    RUN_TEST(test_block_rollover);
+    RUN_TEST(test_chunked_dump);
+    return UNITY_END();
+}
@@ -0,0 +1,105 @@
+// Smoke tests of the native environment: the firmware answers v1 requests through the simulated uart
+
+#include <unity.h>
+#include "avrsim.h"
+#include "serial.h"
+#include "util/delay.h"
+#include <avr/interrupt.h>
+#include <string.h>
+
+#define BYTE_US 521 // One byte at 19200 baud with U2X0, 10 bits
+
+void initialize();
+void parse_command();
+
+// Queue a request on the uart, let the firmware handle it and take the reply, returns the reply size
+static size_t exchange(const unsigned char* request, size_t size, unsigned char* reply, size_t reply_size)
+{
+    avrsim_uart_receive(request, size);
+    _delay_us(BYTE_US * (size + 1));
+    parse_command();
+    _delay_ms(50);
+    return avrsim_uart_sent(reply, reply_size);
+}
+
+void setUp(void)
+{
+    avrsim_uart_capture();
+}
+
+void tearDown(void)
+{
+}
+
+// A threshold written over the uart is read back unchanged
+void test_v1_write_and_read(void)
+{
+    const unsigned char write[] = {CMD_WRITE | CMD_MODE_MIN | CMD_ID_DISTANCE, 0x00, 0x00, 0x48, 0x41, CMD_STOP}; // 12.5
+    const unsigned char write_reply[] = {CMD_WRITE | CMD_MODE_MIN | CMD_ID_DISTANCE, CMD_STOP};
+    const unsigned char read[] = {CMD_READ | CMD_MODE_MIN | CMD_ID_DISTANCE, CMD_STOP};
+    const unsigned char read_reply[] = {CMD_READ | CMD_MODE_MIN | CMD_ID_DISTANCE, 0x00, 0x00, 0x48, 0x41, CMD_STOP};
+    unsigned char reply[16];
+
+    TEST_ASSERT_EQUAL(sizeof(write_reply), exchange(write, sizeof(write), reply, sizeof(reply)));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(write_reply, reply, sizeof(write_reply));
+    TEST_ASSERT_EQUAL(sizeof(read_reply), exchange(read, sizeof(read), reply, sizeof(reply)));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(read_reply, reply, sizeof(read_reply));
+}
+
+// An unknown command gets no reply
+void test_v1_invalid_command(void)
+{
+    const unsigned char request[] = {CMD_WRITE | CMD_MODE_VALUE | CMD_ID_DISTANCE, 0x00, 0x00, 0x00, 0x00, CMD_STOP};
+    unsigned char reply[16];
+
+    TEST_ASSERT_EQUAL(0, exchange(request, sizeof(request), reply, sizeof(reply)));
+}
+
+// The bytes arrive at the uart rate, the frame is complete one byte time after the first byte
+void test_uart_byte_time(void)
+{
+    const unsigned char request[] = {CMD_READ | CMD_MODE_VALUE | CMD_ID_STATUS, CMD_STOP};
+    unsigned char buffer[6] = {0};
+
+    avrsim_uart_receive(request, sizeof(request));
+    _delay_us(BYTE_US * 3 / 2);
+    TEST_ASSERT_FALSE(receive_command(buffer));
+    _delay_us(BYTE_US);
+    TEST_ASSERT_TRUE(receive_command(buffer));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(request, buffer, sizeof(request));
+}
+
+// A stream that does not fit the transmit queue is dropped as a whole, one that fits is sent in order
+void test_tx_queue_back_pressure(void)
+{
+    unsigned char stream[TX_BUFFER_SIZE];
+    unsigned char sent[TX_BUFFER_SIZE];
+    unsigned int dropped = serial_tx_dropped();
+
+    for (unsigned int i = 0; i < sizeof(stream); i++) {
+        stream[i] = i;
+    }
+
+    TEST_ASSERT_FALSE(transmit_byte_stream(stream, TX_BUFFER_SIZE));
+    TEST_ASSERT_EQUAL(dropped + TX_BUFFER_SIZE, serial_tx_dropped());
+    TEST_ASSERT_TRUE(transmit_byte_stream(stream, TX_BUFFER_SIZE - 1));
+    TEST_ASSERT_EQUAL(0, serial_tx_free());
+
+    _delay_ms(100);
+    TEST_ASSERT_EQUAL(TX_BUFFER_SIZE - 1, avrsim_uart_sent(sent, sizeof(sent)));
+    TEST_ASSERT_EQUAL_HEX8_ARRAY(stream, sent, TX_BUFFER_SIZE - 1);
+    TEST_ASSERT_EQUAL(TX_BUFFER_SIZE - 1, serial_tx_free());
+}
+
+int main(void)
+{
+    initialize();
+    sei();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_v1_write_and_read);
+    RUN_TEST(test_v1_invalid_command);
+    RUN_TEST(test_uart_byte_time);
+    RUN_TEST(test_tx_queue_back_pressure);
+    return UNITY_END();
+}
@@ -0,0 +1,151 @@
+// Tests of the delta queue of the scheduler, the tasks log the tick they ran at and the order tells the queue order
+
+#include <unity.h>
+#include "avrsim.h"
+#include "AVR_TTC_scheduler.h"
+#include <stdio.h>
+#include <string.h>
+
+#define TICK_CYCLES (SCH_TICK_COUNTS * 64ULL) // CPU cycles per tick, prescaler 64
+
+static uint64_t start = 0; // The simulated time of SCH_Init_T1()
+static char runs[256];     // The runs so far, task letter and tick
+static unsigned char self = SCH_MAX_TASKS;  // The slot of the task that adds itself again
+
+extern sTask SCH_tasks_G[SCH_MAX_TASKS];
+
+// Log a run of a task
+static void log_run(char task)
+{
+    size_t used = strlen(runs);
+
+    snprintf(runs + used, sizeof(runs) - used, "%s%c%u", used ? " " : "", task,
+             (unsigned int) ((avrsim_cycles() - start) / TICK_CYCLES));
+}
+
+static void task_a(void) { log_run('a'); }
+static void task_b(void) { log_run('b'); }
+static void task_c(void) { log_run('c'); }
+
+// Dispatch the tasks up to the end of a tick
+static void run_until(unsigned int tick)
+{
+    while (avrsim_cycles() - start < (tick + 1) * TICK_CYCLES - 1) {
+        SCH_Dispatch_Tasks();
+    }
+}
+
+void setUp(void)
+{
+    runs[0] = 0;
+    self = SCH_MAX_TASKS;
+    SCH_Init_T1();
+    start = avrsim_cycles();
+    SCH_Start();
+}
+
+void tearDown(void)
+{
+}
+
+// Tasks due at the same tick all run in that tick, also after they were queued again with equal deltas
+void test_equal_deltas(void)
+{
+    SCH_Add_Task(task_a, 1, 4);
+    SCH_Add_Task(task_b, 1, 4);
+    SCH_Add_Task(task_c, 1, 2);
+
+    run_until(10);
+    TEST_ASSERT_EQUAL_STRING("a2 b2 c2 c4 a6 b6 c6 c8 a10 b10 c10", runs);
+}
+
+// The task behind a deleted head inherits its delay and stays due at its own tick
+void test_delete_head(void)
+{
+    unsigned char head = SCH_Add_Task(task_a, 1, 5);
+
+    SCH_Add_Task(task_b, 4, 5);
+    SCH_Add_Task(task_c, 4, 0);
+
+    run_until(1);
+    SCH_Delete_Task(head);
+    run_until(12);
+    TEST_ASSERT_EQUAL_STRING("b5 c5 b10", runs);
+}
+
+// Deleting a task in the middle of the queue leaves the tasks behind it on time
+void test_delete_middle(void)
+{
+    SCH_Add_Task(task_a, 1, 0);
+    unsigned char middle = SCH_Add_Task(task_b, 3, 0);
+    SCH_Add_Task(task_c, 6, 0);
+
+    SCH_Delete_Task(middle);
+    run_until(10);
+    TEST_ASSERT_EQUAL_STRING("a2 c7", runs);
+}
+
+// A periodic task that deletes itself and adds itself again with another timing gets its own slot back
+static void task_self_periodic(void)
+{
+    log_run('p');
+    if (SCH_tasks_G[self].Period == 1) {
+        SCH_Delete_Task(self);
+        self = SCH_Add_Task(task_self_periodic, 2, 3);
+    }
+}
+
+void test_readd_periodic_during_dispatch(void)
+{
+    self = SCH_Add_Task(task_self_periodic, 1, 1);
+    SCH_Add_Task(task_a, 3, 0);
+
+    run_until(11);
+    TEST_ASSERT_EQUAL_STRING("p2 a4 p5 p8 p11", runs);
+}
+
+// A one shot task that adds itself again runs once per add, in the slot it ran from
+static void task_self_once(void)
+{
+    log_run('o');
+    SCH_Add_Task(task_self_once, 1, 0);
+}
+
+void test_readd_one_shot_during_dispatch(void)
+{
+    SCH_Add_Task(task_self_once, 0, 0);
+    SCH_Add_Task(task_a, 2, 3);
+
+    run_until(7);
+    TEST_ASSERT_EQUAL_STRING("o1 o3 a3 o5 a6 o7", runs);
+}
+
+// A one shot task that deletes itself first and adds itself again
+static void task_self_delete_once(void)
+{
+    log_run('d');
+    SCH_Delete_Task(self);
+    self = SCH_Add_Task(task_self_delete_once, 2, 0);
+}
+
+void test_readd_deleted_one_shot_during_dispatch(void)
+{
+    self = SCH_Add_Task(task_self_delete_once, 0, 0);
+
+    run_until(7);
+    TEST_ASSERT_EQUAL_STRING("d1 d4 d7", runs);
+}
+
+int main(void)
+{
+    avrsim_uart_capture();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_equal_deltas);
+    RUN_TEST(test_delete_head);
+    RUN_TEST(test_delete_middle);
+    RUN_TEST(test_readd_periodic_during_dispatch);
+    RUN_TEST(test_readd_one_shot_during_dispatch);
+    RUN_TEST(test_readd_deleted_one_shot_during_dispatch);
+    return UNITY_END();
+}
@@ -0,0 +1,56 @@
+// Tests of the ping timing of the ultrasound bursts against the simulated HC-SR04
+
+#include <unity.h>
+#include "avrsim.h"
+#include "AVR_TTC_scheduler.h"
+#include "ultrasound.h"
+#include "util/delay.h"
+#include <stdlib.h>
+
+#define BURSTS 200              // Bursts per test, the simulated echoes come from a fixed seed
+#define BURST_MS 400            // The period of ultrasonor_task
+
+void setUp(void)
+{
+}
+
+void tearDown(void)
+{
+}
+
+// Returns the average confidence of the bursts
+static unsigned int run_bursts(void)
+{
+    unsigned long total = 0;
+
+    for (unsigned int i = 0; i < BURSTS; i++) {
+        fixed_t distance;
+
+        trigger_ultrasonor();
+        _delay_ms(BURST_MS);
+        total += get_distance(&distance);
+    }
+    return total / BURSTS;
+}
+
+// A lost echo only costs its own ping, the sensor holds the echo high for 38 ms and the next ping waits for it.
+// 30% of the echoes are lost, when a lost echo also cost the next ping the average confidence was 57%.
+void test_lost_echoes(void)
+{
+    TEST_ASSERT_TRUE(run_bursts() >= 65);
+}
+
+int main(void)
+{
+    // The simulator reads its environment once
+    setenv("AVRSIM_ECHO_LOST", "0.3", 1);
+    avrsim_uart_capture();
+
+    SCH_Init_T1();
+    setup_ultrasound(SCH_MAX_TASKS);
+    SCH_Start();
+
+    UNITY_BEGIN();
+    RUN_TEST(test_lost_echoes);
+    return UNITY_END();
+}
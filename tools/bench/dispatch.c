@@ -0,0 +1,233 @@
+/*------------------------------------------------------------------*-
+
+  dispatch.c
+
+  Host benchmark of the command dispatch in execute().  Times the
+  command table of main.c against the if/else tree it replaced, both
+  over the same mix of reads and an invalid command, and checks that
+  both paths leave the same reply in the buffer.  The transmit queue
+  is drained after every command as USART_UDRE_vect does on the AVR,
+  so every reply is queued rather than dropped and the times include
+  its send, the same for both paths.  The run fails when a reply was
+  dropped after all.
+
+  The times are host nanoseconds, not AVR cycles.  avrsim runs
+  firmware code in zero simulated time and only advances its cycle
+  clock while the firmware sleeps, so it cannot count the cycles of
+  the calls.  Compare the two paths with each other rather than with
+  the AVR.
+
+  Build and run:
+
+    make -C tools/bench
+    tools/bench/dispatch [rounds]
+
+-*------------------------------------------------------------------*/
+
+// The benchmark needs the static state and handlers of the firmware
+#define main firmware_main
+#include "../../src/main.c"
+#undef main
+
+#include <stdlib.h>
+#include <time.h>
+
+// The reads of every field and a write with CMD_MODE_VALUE, which both paths reject
+static const unsigned char mix[] = {
+    CMD_READ | CMD_MODE_VALUE | CMD_ID_STATUS,
+    CMD_READ | CMD_MODE_VALUE | CMD_ID_DISTANCE,
+    CMD_READ | CMD_MODE_VALUE | CMD_ID_TRIGGER_SENSOR,
+    CMD_READ | CMD_MODE_VALUE | CMD_ID_UUID,
+    CMD_READ | CMD_MODE_MIN | CMD_ID_DISTANCE,
+    CMD_READ | CMD_MODE_MIN | CMD_ID_TRIGGER_SENSOR,
+    CMD_READ | CMD_MODE_MAX | CMD_ID_DISTANCE,
+    CMD_READ | CMD_MODE_MAX | CMD_ID_TRIGGER_SENSOR,
+    CMD_WRITE | CMD_MODE_VALUE | CMD_ID_DISTANCE,
+};
+#define MIX_SIZE (sizeof(mix) / sizeof(mix[0]))
+
+// Reply with a field like the old tree did for every read
+static void tree_read(unsigned char* buffer, fixed_t value)
+{
+    unsigned char content_buffer[4];
+
+    fixed_to_bytes(value, content_buffer);
+    set_content_bytes(content_buffer, buffer);
+}
+
+// Write a threshold like the old tree did for every write
+static void tree_write(unsigned char* buffer, fixed_t* field)
+{
+    unsigned char content_buffer[4];
+
+    get_content_bytes(buffer, content_buffer);
+    *field = bytes_to_fixed(content_buffer);
+    config_save(&settings);
+}
+
+// The if/else tree of execute() before the command table, on the fields of the current tree
+static void execute_tree(unsigned char* buffer)
+{
+    unsigned char content_buffer[4];
+    unsigned char function = buffer[0] & CMD_FUNCTION_MASK;
+    unsigned char value = buffer[0] & CMD_VALUE_MASK;
+    unsigned char id = buffer[0] & CMD_ID_MASK;
+
+    if (function == CMD_WRITE) {
+        if (value == CMD_MODE_MIN) {
+            if (id == CMD_ID_DISTANCE) {
+                tree_write(buffer, &settings.distanceMin);
+            }
+            else if (id == CMD_ID_TRIGGER_SENSOR) {
+                tree_write(buffer, &settings.sensors[selectedSensor].min);
+            }
+            else {
+                set_error_flag(buffer, ERR_INVALID);
+            }
+        }
+        else if (value == CMD_MODE_MAX) {
+            if (id == CMD_ID_DISTANCE) {
+                tree_write(buffer, &settings.distanceMax);
+            }
+            else if (id == CMD_ID_TRIGGER_SENSOR) {
+                tree_write(buffer, &settings.sensors[selectedSensor].max);
+            }
+            else {
+                set_error_flag(buffer, ERR_INVALID);
+            }
+        }
+        else {
+            set_error_flag(buffer, ERR_INVALID);
+        }
+        if ((buffer[0] & ERR_MASK) == ERR_VALID) {
+            buffer[1] = 0xff;
+            transmit_frame(buffer, 2, 0);
+        }
+    }
+    else {
+        if (value == CMD_MODE_VALUE) {
+            if (id == CMD_ID_STATUS) {
+                long_to_bytes(currentState, content_buffer);
+                set_content_bytes(content_buffer, buffer);
+            }
+            else if (id == CMD_ID_DISTANCE) {
+                tree_read(buffer, distance);
+            }
+            else if (id == CMD_ID_TRIGGER_SENSOR) {
+                tree_read(buffer, sensorValues[selectedSensor]);
+            }
+            else {
+                memcpy(content_buffer, serial, sizeof(serial));
+                content_buffer[3] = sensors[selectedSensor].type;
+                set_content_bytes(content_buffer, buffer);
+            }
+        }
+        else if (value == CMD_MODE_MIN) {
+            if (id == CMD_ID_DISTANCE) {
+                tree_read(buffer, settings.distanceMin);
+            }
+            else if (id == CMD_ID_TRIGGER_SENSOR) {
+                tree_read(buffer, settings.sensors[selectedSensor].min);
+            }
+            else {
+                set_error_flag(buffer, ERR_INVALID);
+            }
+        }
+        else if (value == CMD_MODE_MAX) {
+            if (id == CMD_ID_DISTANCE) {
+                tree_read(buffer, settings.distanceMax);
+            }
+            else if (id == CMD_ID_TRIGGER_SENSOR) {
+                tree_read(buffer, settings.sensors[selectedSensor].max);
+            }
+            else {
+                set_error_flag(buffer, ERR_INVALID);
+            }
+        }
+        else {
+            set_error_flag(buffer, ERR_INVALID);
+        }
+        if ((buffer[0] & ERR_MASK) == ERR_VALID) {
+            transmit_frame(buffer, 6, 0);
+        }
+    }
+}
+
+static double now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Send the queued bytes like the interrupt does on the AVR
+static void drain(void)
+{
+    while (UCSR0B & _BV(UDRIE0)) {
+        USART_UDRE_vect();
+    }
+}
+
+// Run the mix for the amount of rounds, returns the nanoseconds per command
+static double run(void (*dispatch)(unsigned char*), long rounds)
+{
+    unsigned char buffer[6];
+    double start = now_ns();
+
+    for (long r = 0; r < rounds; r++) {
+        for (unsigned char i = 0; i < MIX_SIZE; i++) {
+            memset(buffer, 0, sizeof(buffer));
+            buffer[0] = mix[i];
+            buffer[5] = CMD_STOP;
+            dispatch(buffer);
+            drain();
+        }
+    }
+    return (now_ns() - start) / (rounds * MIX_SIZE);
+}
+
+int main(int argc, char** argv)
+{
+    long rounds = argc > 1 ? atol(argv[1]) : 1000000;
+    double table = 1e9;
+    double tree = 1e9;
+
+    // The replies only fill the transmit queue, keep the simulated UART off stdout
+    setenv("AVRSIM_UART", "/dev/null", 0);
+    initialize();
+    distance = FIXED_FROM_INT(42);
+    sensorValues[selectedSensor] = FIXED_FROM_INT(512);
+
+    // Both paths have to leave the same reply in the buffer
+    for (unsigned char i = 0; i < MIX_SIZE; i++) {
+        unsigned char a[6] = {mix[i], 0, 0, 0, 0, CMD_STOP};
+        unsigned char b[6] = {mix[i], 0, 0, 0, 0, CMD_STOP};
+
+        execute(a);
+        execute_tree(b);
+        drain();
+        if (memcmp(a, b, sizeof(a)) != 0) {
+            fprintf(stderr, "dispatch: command 0x%02X differs\n", mix[i]);
+            return 1;
+        }
+    }
+
+    // Alternate the paths and keep the best run of each, that is the least disturbed one
+    for (int i = 0; i < 5; i++) {
+        double t = run(execute, rounds);
+        table = t < table ? t : table;
+        t = run(execute_tree, rounds);
+        tree = t < tree ? t : tree;
+    }
+
+    // A dropped reply leaves the send out of the time
+    if (serial_tx_dropped() != 0) {
+        fprintf(stderr, "dispatch: %u bytes dropped\n", (unsigned) serial_tx_dropped());
+        return 1;
+    }
+
+    printf("table  %6.2f host ns per command\n", table);
+    printf("tree   %6.2f host ns per command\n", tree);
+    return 0;
+}
@@ -0,0 +1,282 @@
+/*------------------------------------------------------------------*-
+
+  bench.cpp
+
+  Host benchmark of the codec.  Times the request builders and the
+  in place parse of a value, batch, task statistics and full history
+  reply, with every field of a reply read and every sample of the
+  history decoded, and checks first that every view takes its reply.
+  Also times encode() and FrameParser on the full history reply in
+  bus framing, the largest frame a link carries.
+
+  The content of the requests changes every round, so the compiler
+  cannot build them at compile time as it does for constants.
+
+  Build and run:
+
+    make -C tools/codec bench
+    tools/codec/bench [rounds]
+
+-*------------------------------------------------------------------*/
+
+#include "codec.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+using namespace codec;
+
+using Clock = std::chrono::steady_clock;
+
+// Takes the results, so the compiler keeps the work that computes them
+static volatile uint32_t sink;
+
+static void append_float(std::vector<uint8_t> &frame, float value)
+{
+    uint8_t bytes[4];
+
+    float_to_le(value, bytes);
+    frame.insert(frame.end(), bytes, bytes + 4);
+}
+
+static std::vector<uint8_t> value_reply()
+{
+    std::vector<uint8_t> frame = {command(Function::read, Mode::value, Id::distance)};
+
+    append_float(frame, 42.5f);
+    frame.push_back(CMD_STOP);
+    return frame;
+}
+
+static std::vector<uint8_t> batch_reply()
+{
+    std::vector<uint8_t> frame = {CMD_EXT_BATCH, 0xFF};
+
+    for (int i = 0; i < 8; i++) {
+        append_float(frame, 1.5f * i);
+    }
+    frame.push_back(CMD_STOP);
+    return frame;
+}
+
+static std::vector<uint8_t> task_stats_reply()
+{
+    std::vector<uint8_t> frame = {CMD_EXT_TASK_STATS, 2};
+    const float fields[] = {120, 480, 200, 30, 0, 3};
+
+    for (float field : fields) {
+        append_float(frame, field);
+    }
+    frame.push_back(CMD_STOP);
+    return frame;
+}
+
+// A full dump, every block filled with one byte deltas that go up and down by one
+static std::vector<uint8_t> history_reply()
+{
+    std::vector<uint8_t> frame = {CMD_EXT_HISTORY, HISTORY_BLOCKS, HISTORY_PERIOD, 0, 0};
+
+    for (uint32_t block = 0; block < HISTORY_BLOCKS; block++) {
+        size_t start = frame.size();
+        uint32_t first = block * 100;
+
+        frame.push_back(0);
+        for (int i = 0; i < 4; i++) {
+            frame.push_back(uint8_t(first >> (8 * i)));
+        }
+        for (size_t i = 0; i < HISTORY_VALUES; i++) {
+            frame.push_back(uint8_t(10 * i));
+            frame.push_back(0);
+        }
+        for (int sample = 0; frame.size() - start + HISTORY_VALUES <= HISTORY_BLOCK_SIZE; sample++) {
+            for (size_t i = 0; i < HISTORY_VALUES; i++) {
+                frame.push_back(sample % 2 ? 1 : 2);
+            }
+        }
+        frame[start] = uint8_t(frame.size() - start);
+    }
+
+    size_t length = frame.size() - HISTORY_DUMP_HEADER_SIZE;
+    frame[3] = uint8_t(length);
+    frame[4] = uint8_t(length >> 8);
+    frame.push_back(CMD_STOP);
+    return frame;
+}
+
+// The requests built per round
+static constexpr int REQUESTS = 6;
+
+// The requests of a round, returns a sum of their bytes
+static uint32_t build(uint32_t round)
+{
+    const Request requests[REQUESTS] = {
+        read(Mode::value, Id::distance),
+        batch(uint8_t(round)),
+        task_stats(round & 7, round & 8),
+        history(round & 15),
+        subscribe(uint8_t(round), 10, 2, 3),
+        write_threshold(Mode::max, Id::distance, float(round)),
+    };
+    uint32_t sum = 0;
+
+    for (const Request &request : requests) {
+        for (uint8_t data : request.frame()) {
+            sum += data;
+        }
+    }
+    return sum;
+}
+
+static uint32_t parse_value(Bytes frame)
+{
+    ValueReply reply(frame);
+
+    return reply.valid() ? uint32_t(reply.status()) : 0;
+}
+
+static uint32_t parse_batch(Bytes frame)
+{
+    BatchReply reply(frame);
+    uint32_t sum = 0;
+
+    if (!reply.valid()) {
+        return 0;
+    }
+    for (unsigned field = 1; field <= 0x80; field <<= 1) {
+        if (reply.has(field)) {
+            sum += u32_from_float(reply.value(field));
+        }
+    }
+    return sum;
+}
+
+static uint32_t parse_task_stats(Bytes frame)
+{
+    TaskStatsReply reply(frame);
+
+    if (!reply.valid()) {
+        return 0;
+    }
+    return reply.task() + reply.exec_min() + reply.exec_max() + reply.exec_average() + reply.jitter_max() +
+           reply.missed() + reply.backlog_max();
+}
+
+// Returns the amount of samples, the values go to the sink
+static uint32_t parse_history(Bytes frame)
+{
+    HistoryReply reply(frame);
+    HistoryBlock block;
+    size_t offset = 0;
+    uint32_t samples = 0;
+    uint32_t sum = 0;
+
+    while (reply.next(offset, block)) {
+        HistoryBlock::Cursor cursor(block);
+        uint32_t number;
+        fixed_t values[HISTORY_VALUES];
+
+        while (cursor.next(number, values)) {
+            sum += number + uint32_t(values[0]);
+            samples++;
+        }
+    }
+    sink = sink + sum;
+    return samples;
+}
+
+// Encode a frame into a buffer that keeps its capacity, returns the size on the line
+static uint32_t encode_frame(const Frame &frame, std::vector<uint8_t> &out)
+{
+    out.clear();
+    encode(out, frame);
+    return uint32_t(out.size());
+}
+
+// Parse the bytes of a link, returns the content bytes of the frames taken
+static uint32_t parse_frames(FrameParser &parser, const std::vector<uint8_t> &bytes)
+{
+    Frame frame;
+    uint32_t sum = 0;
+
+    for (uint8_t data : bytes) {
+        if (parser.feed(data, frame)) {
+            sum += uint32_t(frame.content.size());
+        }
+    }
+    return sum;
+}
+
+// Run the work for the amount of rounds a few times, returns the nanoseconds per call of the best run, that is
+// the least disturbed one
+template <typename Work>
+static double run(Work work, long rounds)
+{
+    double best = 1e9;
+
+    for (int i = 0; i < 5; i++) {
+        Clock::time_point start = Clock::now();
+        uint32_t sum = 0;
+
+        for (long r = 0; r < rounds; r++) {
+            sum += work(uint32_t(r));
+        }
+        sink = sink + sum;
+
+        double t = std::chrono::duration<double, std::nano>(Clock::now() - start).count() / rounds;
+        best = t < best ? t : best;
+    }
+    return best;
+}
+
+int main(int argc, char **argv)
+{
+    long rounds = argc > 1 ? atol(argv[1]) : 1000000;
+    const std::vector<uint8_t> value = value_reply();
+    const std::vector<uint8_t> batch = batch_reply();
+    const std::vector<uint8_t> stats = task_stats_reply();
+    const std::vector<uint8_t> history = history_reply();
+    Frame frame;
+    std::vector<uint8_t> line;
+    FrameParser parser;
+
+    if (rounds <= 0) {
+        fprintf(stderr, "usage: bench [rounds]\n");
+        return 2;
+    }
+
+    // Every view has to take its reply, or the parse times measure the rejection
+    if (!ValueReply(Bytes(value)).valid() || !BatchReply(Bytes(batch)).valid() || !TaskStatsReply(Bytes(stats)).valid() ||
+        !HistoryReply(Bytes(history)).valid()) {
+        fprintf(stderr, "bench: a view rejects its reply\n");
+        return 1;
+    }
+
+    // The history reply in bus framing, the parser has to take it back
+    frame.bus = true;
+    frame.address = 5;
+    frame.seq = 1;
+    frame.content.assign(history.begin(), history.end() - 1);
+    encode_frame(frame, line);
+    if (parse_frames(parser, line) != frame.content.size()) {
+        fprintf(stderr, "bench: the parser rejects the frame\n");
+        return 1;
+    }
+
+    printf("request  %8.2f ns per request\n", run(build, rounds) / REQUESTS);
+    printf("value    %8.2f ns per %zu byte reply\n", run([&](uint32_t) { return parse_value(Bytes(value)); }, rounds),
+           value.size());
+    printf("batch    %8.2f ns per %zu byte reply\n", run([&](uint32_t) { return parse_batch(Bytes(batch)); }, rounds),
+           batch.size());
+    printf("stats    %8.2f ns per %zu byte reply\n", run([&](uint32_t) { return parse_task_stats(Bytes(stats)); }, rounds),
+           stats.size());
+    printf("history  %8.2f ns per %zu byte reply of %u samples\n",
+           run([&](uint32_t) { return parse_history(Bytes(history)); }, rounds), history.size(),
+           parse_history(Bytes(history)));
+    printf("encode   %8.2f ns per %zu byte bus frame\n", run([&](uint32_t) { return encode_frame(frame, line); }, rounds),
+           line.size());
+    printf("parse    %8.2f ns per %zu byte bus frame\n", run([&](uint32_t) { return parse_frames(parser, line); }, rounds),
+           line.size());
+    return 0;
+}
@@ -0,0 +1,591 @@
+#ifndef CODEC_CODEC_HPP
+#define CODEC_CODEC_HPP
+
+/*------------------------------------------------------------------*-
+
+  codec.hpp
+
+  Header-only codec of the protocol for host tools, the v1 frame
+  layout and the v2 and bus framing around it, see include/serial.h.
+  The command byte builders are constexpr and
+  derived from the masks of serial.h, so a request with constant
+  content is built at compile time:
+
+    constexpr codec::Request stats = codec::task_stats(2, true);
+    write(fd, stats.frame().data(), stats.frame().size());
+
+  Replies are parsed in place: a view holds a pointer into the bytes
+  of the caller and decodes a field only when it is read.  A view
+  takes the v1 frame with its stop byte as well as the content of a
+  v2 or bus frame, where the stop byte is left out.  Check valid()
+  before reading fields, the accessors assume a well formed reply.
+  The constructors, valid() and the walk of the history blocks and
+  samples never read outside the bytes they were given, whatever
+  those hold.
+
+  FrameParser takes the bytes of a link one at a time and hands out
+  the content of every v2 or bus frame with a valid CRC, encode()
+  builds such a frame.  The gateway and other hosts share them, so
+  there is one copy of the CRC and the escaping.  fuzz.cpp holds the
+  views and the parser to the above, bench.cpp times the builders,
+  the views and the framing.
+
+  The floats of the protocol are IEEE single precision in little
+  endian order, the order the station writes them in on the AVR.
+  They are assembled byte by byte, so the codec works on hosts of
+  either byte order.
+
+-*------------------------------------------------------------------*/
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+extern "C" {
+#include "history.h"
+#include "serial.h"
+}
+
+namespace codec {
+
+static_assert(std::numeric_limits<float>::is_iec559 && sizeof(float) == 4,
+              "the protocol carries IEEE single precision floats");
+
+// A read-only view of bytes the caller owns, nothing is copied
+class Bytes {
+public:
+    constexpr Bytes() = default;
+    constexpr Bytes(const uint8_t *data, size_t size) : data_(data), size_(size) {}
+    explicit Bytes(const std::vector<uint8_t> &bytes) : data_(bytes.data()), size_(bytes.size()) {}
+    Bytes(std::vector<uint8_t> &&) = delete;           // A view of a temporary would dangle
+
+    constexpr const uint8_t *data() const { return data_; }
+    constexpr size_t size() const { return size_; }
+    constexpr bool empty() const { return size_ == 0; }
+    constexpr uint8_t operator[](size_t index) const { return data_[index]; }
+    constexpr const uint8_t *begin() const { return data_; }
+    constexpr const uint8_t *end() const { return data_ + size_; }
+
+    // The bytes from offset on, at most size of them
+    constexpr Bytes sub(size_t offset, size_t size = SIZE_MAX) const
+    {
+        if (offset > size_) {
+            offset = size_;
+        }
+        return Bytes(data_ + offset, size < size_ - offset ? size : size_ - offset);
+    }
+
+private:
+    const uint8_t *data_ = nullptr;
+    size_t size_ = 0;
+};
+
+//------------------------------------------------------------------
+// Command byte
+//------------------------------------------------------------------
+
+enum class Function : uint8_t { read = CMD_READ, write = CMD_WRITE };
+enum class Mode : uint8_t { value = CMD_MODE_VALUE, min = CMD_MODE_MIN, max = CMD_MODE_MAX, extended = CMD_MODE_EXTENDED };
+enum class Id : uint8_t { status = CMD_ID_STATUS, distance = CMD_ID_DISTANCE, trigger_sensor = CMD_ID_TRIGGER_SENSOR, uuid = CMD_ID_UUID };
+
+constexpr uint8_t command(Function function, Mode mode, Id id)
+{
+    return uint8_t(function) | uint8_t(mode) | uint8_t(id);
+}
+
+// The extended command with the index in the id bits
+constexpr uint8_t extended(Function function, uint8_t index)
+{
+    return uint8_t(function) | CMD_MODE_EXTENDED | ((index << 3) & CMD_ID_MASK);
+}
+
+constexpr Function function_of(uint8_t command) { return Function(command & CMD_FUNCTION_MASK); }
+constexpr Mode mode_of(uint8_t command) { return Mode(command & CMD_VALUE_MASK); }
+constexpr Id id_of(uint8_t command) { return Id(command & CMD_ID_MASK); }
+constexpr uint8_t error_of(uint8_t command) { return command & ERR_MASK; }
+constexpr uint8_t strip_error(uint8_t command) { return command & CMD_MASK; }
+
+// The amount of content bytes that follow the command byte of a request
+constexpr size_t content_length(uint8_t command)
+{
+    if (function_of(command) == Function::write) {
+        return 4;
+    }
+    return mode_of(command) == Mode::extended ? 1 : 0;
+}
+
+// The builders must reproduce the commands the station dispatches on
+static_assert((CMD_MASK & ERR_MASK) == 0 && (CMD_MASK | ERR_MASK) == 0xFF, "the command and error bits share a byte");
+static_assert(command(Function::read, Mode::max, Id::trigger_sensor) == (CMD_READ | CMD_MODE_MAX | CMD_ID_TRIGGER_SENSOR), "");
+static_assert(extended(Function::read, 0) == CMD_EXT_BATCH && extended(Function::read, 1) == CMD_EXT_TASK_STATS &&
+              extended(Function::read, 2) == CMD_EXT_HISTORY && extended(Function::read, 3) == CMD_EXT_DISCOVER, "");
+static_assert(extended(Function::write, 0) == CMD_EXT_SUBSCRIBE && extended(Function::write, 1) == CMD_EXT_RATE &&
+              extended(Function::write, 2) == CMD_EXT_SENSOR && extended(Function::write, 3) == CMD_EXT_ADDRESS, "");
+
+//------------------------------------------------------------------
+// Little endian fields
+//------------------------------------------------------------------
+
+constexpr uint16_t u16_from_le(const uint8_t *bytes)
+{
+    return uint16_t(bytes[0] | (bytes[1] << 8));
+}
+
+constexpr uint32_t u32_from_le(const uint8_t *bytes)
+{
+    return uint32_t(bytes[0]) | (uint32_t(bytes[1]) << 8) | (uint32_t(bytes[2]) << 16) | (uint32_t(bytes[3]) << 24);
+}
+
+inline float float_from_le(const uint8_t *bytes)
+{
+    uint32_t bits = u32_from_le(bytes);
+    float value;
+
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+// A float of the station as an integer, NaN reads 0 and the values out of range saturate where a cast is undefined
+inline uint32_t u32_from_float(float value)
+{
+    if (!(value > 0.0f)) {
+        return 0;
+    }
+    return value < 4294967296.0f ? uint32_t(value) : UINT32_MAX;
+}
+
+inline int32_t i32_from_float(float value)
+{
+    if (value != value) {
+        return 0;
+    }
+    if (value <= -2147483648.0f) {
+        return INT32_MIN;
+    }
+    return value < 2147483648.0f ? int32_t(value) : INT32_MAX;
+}
+
+inline void float_to_le(float value, uint8_t *bytes)
+{
+    uint32_t bits;
+
+    std::memcpy(&bits, &value, sizeof(bits));
+    for (int i = 0; i < 4; i++) {
+        bytes[i] = uint8_t(bits >> (8 * i));
+    }
+}
+
+// A fixed point value of the history as a float
+constexpr float fixed_to_float(fixed_t value)
+{
+    return float(value) / FIXED_ONE;
+}
+
+//------------------------------------------------------------------
+// Requests
+//------------------------------------------------------------------
+
+// A request in v1 layout, the command byte, the content and the stop byte
+struct Request {
+    uint8_t bytes[7] = {};
+    uint8_t size = 0;
+
+    // The v1 frame with the stop byte
+    constexpr Bytes frame() const { return Bytes(bytes, size); }
+
+    // The frame without the stop byte, the payload of a v2 or bus frame
+    constexpr Bytes content() const { return Bytes(bytes, size - 1); }
+};
+
+// A request from the command byte and the content bytes, content_length of them are used
+constexpr Request request(uint8_t command, uint8_t b0 = 0, uint8_t b1 = 0, uint8_t b2 = 0, uint8_t b3 = 0)
+{
+    Request request;
+    const uint8_t content[4] = {b0, b1, b2, b3};
+    size_t length = content_length(command);
+
+    request.bytes[0] = strip_error(command);
+    for (size_t i = 0; i < length; i++) {
+        request.bytes[1 + i] = content[i];
+    }
+    request.bytes[1 + length] = CMD_STOP;
+    request.size = uint8_t(2 + length);
+    return request;
+}
+
+constexpr Request read(Mode mode, Id id)
+{
+    return request(command(Function::read, mode, id));
+}
+
+constexpr Request batch(uint8_t fields) { return request(CMD_EXT_BATCH, fields); }
+constexpr Request task_stats(uint8_t task, bool reset = false) { return request(CMD_EXT_TASK_STATS, task | (reset ? TASK_STATS_RESET : 0)); }
+constexpr Request history(uint8_t blocks = 0) { return request(CMD_EXT_HISTORY, blocks); }
+constexpr Request discover(uint8_t first) { return request(CMD_EXT_DISCOVER, first); }
+
+constexpr Request subscribe(uint8_t fields, uint8_t period, uint8_t distance_deadband, uint8_t trigger_deadband)
+{
+    return request(CMD_EXT_SUBSCRIBE, fields, period, distance_deadband, trigger_deadband);
+}
+
+constexpr Request set_rate(uint8_t index) { return request(CMD_EXT_RATE, index); }
+constexpr Request select_sensor(uint8_t index, bool store = false) { return request(CMD_EXT_SENSOR, index, store ? SENSOR_STORE : 0); }
+constexpr Request set_address(uint8_t address) { return request(CMD_EXT_ADDRESS, address); }
+
+// The request for one sensor instead of the selected one, the index follows the content, only send its content() in v2 or bus framing
+constexpr Request for_sensor(Request request, uint8_t index)
+{
+    request.bytes[request.size - 1] = index;
+    request.bytes[request.size] = CMD_STOP;
+    request.size++;
+    return request;
+}
+
+static_assert(for_sensor(subscribe(1, 2, 3, 4), 1).size == 7, "the largest request takes a sensor index as well");
+
+// Write a threshold, only the min and max modes are writable, not constexpr as the float needs its bits
+inline Request write_threshold(Mode mode, Id id, float value)
+{
+    uint8_t content[4];
+
+    float_to_le(value, content);
+    return request(command(Function::write, mode, id), content[0], content[1], content[2], content[3]);
+}
+
+//------------------------------------------------------------------
+// v2 and bus framing
+//------------------------------------------------------------------
+
+struct Frame {
+    bool bus = false;                   // Set for a bus frame
+    uint8_t address = 0;                // The station address of a bus frame
+    uint8_t seq = 0;                    // The sequence number, FRAME_PUSH_SEQ for a push
+    std::vector<uint8_t> content;       // The v1 frame without the stop byte
+};
+
+// The CRC16 of the station, _crc16_update of avr-libc
+inline uint16_t crc16_update(uint16_t crc, uint8_t data)
+{
+    crc ^= data;
+    for (int i = 0; i < 8; i++) {
+        crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    }
+    return crc;
+}
+
+// Append a payload byte, escaping the bytes that delimit a frame
+inline void append_escaped(std::vector<uint8_t> &out, uint8_t data)
+{
+    if (data == FRAME_END || data == FRAME_ESC) {
+        out.push_back(FRAME_ESC);
+        data = (data == FRAME_END) ? FRAME_ESC_END : FRAME_ESC_ESC;
+    }
+    out.push_back(data);
+}
+
+// Append a frame in v2 framing, or in bus framing with the address of a bus station
+inline void encode(std::vector<uint8_t> &out, const Frame &frame)
+{
+    uint16_t crc = 0xFFFF;
+
+    out.push_back(frame.bus ? FRAME_SYNC_BUS : FRAME_SYNC);
+    if (frame.bus) {
+        crc = crc16_update(crc, frame.address);
+        append_escaped(out, frame.address);
+    }
+    crc = crc16_update(crc, frame.seq);
+    append_escaped(out, frame.seq);
+    for (uint8_t data : frame.content) {
+        crc = crc16_update(crc, data);
+        append_escaped(out, data);
+    }
+    append_escaped(out, crc & 0xFF);
+    append_escaped(out, crc >> 8);
+    out.push_back(FRAME_END);
+}
+
+// Incremental parser of the v2 and bus frames of the stations, other bytes are skipped
+class FrameParser {
+public:
+    // Feed a byte, returns true when it completed a valid frame
+    bool feed(uint8_t data, Frame &frame)
+    {
+        if (!in_frame_) {
+            if (data == FRAME_SYNC || data == FRAME_SYNC_BUS) {
+                in_frame_ = true;
+                bus_ = (data == FRAME_SYNC_BUS);
+                escape_ = false;
+                payload_.clear();
+            }
+            return false;
+        }
+
+        if (data != FRAME_END) {
+            if (data == FRAME_ESC) {
+                escape_ = true;
+                return false;
+            }
+            if (escape_) {
+                escape_ = false;
+                data = (data == FRAME_ESC_END) ? FRAME_END : (data == FRAME_ESC_ESC) ? FRAME_ESC : data;
+            }
+            if (payload_.size() < MAX_PAYLOAD) {
+                payload_.push_back(data);
+            }
+            return false;
+        }
+
+        // The frame is complete, drop it when it is too short or the CRC is wrong
+        in_frame_ = false;
+        size_t header = bus_ ? 2 : 1;
+        if (payload_.size() < header + 3) {
+            return false;
+        }
+        uint16_t crc = 0xFFFF;
+        for (size_t i = 0; i < payload_.size() - 2; i++) {
+            crc = crc16_update(crc, payload_[i]);
+        }
+        if (payload_[payload_.size() - 2] != (crc & 0xFF) || payload_[payload_.size() - 1] != (crc >> 8)) {
+            return false;
+        }
+
+        frame.bus = bus_;
+        frame.address = bus_ ? payload_[0] : 0;
+        frame.seq = payload_[header - 1];
+        frame.content.assign(payload_.begin() + header, payload_.end() - 2);
+        return true;
+    }
+
+private:
+    static constexpr size_t MAX_PAYLOAD = 600;  // Longer than a full history dump, longer frames are cut and fail the CRC
+
+    bool in_frame_ = false;
+    bool bus_ = false;
+    bool escape_ = false;
+    std::vector<uint8_t> payload_;
+};
+
+//------------------------------------------------------------------
+// Replies
+//------------------------------------------------------------------
+
+// Locates the body of a reply, the bytes between the command byte and the stop byte, returns false when it is not size bytes long
+constexpr bool body_of(Bytes frame, size_t size, Bytes &body)
+{
+    if (frame.size() == 1 + size || (frame.size() == 2 + size && frame[1 + size] == CMD_STOP)) {
+        body = frame.sub(1, size);
+        return true;
+    }
+    return false;
+}
+
+// The fields every reply shares, a view is only valid when its command and length match the frame
+class Reply {
+public:
+    constexpr explicit Reply(Bytes frame) : frame_(frame) {}
+
+    constexpr bool valid() const { return valid_; }
+    constexpr uint8_t command() const { return frame_.empty() ? 0 : strip_error(frame_[0]); }
+    constexpr uint8_t error() const { return frame_.empty() ? ERR_INVALID : error_of(frame_[0]); }
+    constexpr Bytes frame() const { return frame_; }
+    constexpr Bytes body() const { return body_; }
+
+protected:
+    // Locate a body of size bytes when the command byte carries no error
+    constexpr bool locate(size_t size) { return error() == ERR_VALID && body_of(frame_, size, body_); }
+
+    Bytes frame_;
+    Bytes body_;
+    bool valid_ = false;
+};
+
+// The reply of a write, the command byte alone
+class WriteReply : public Reply {
+public:
+    constexpr explicit WriteReply(Bytes frame) : Reply(frame)
+    {
+        valid_ = function_of(command()) == Function::write && locate(0);
+    }
+};
+
+// The reply of a value, min or max read
+class ValueReply : public Reply {
+public:
+    constexpr explicit ValueReply(Bytes frame) : Reply(frame)
+    {
+        valid_ = function_of(command()) == Function::read && mode_of(command()) != Mode::extended && locate(4);
+    }
+
+    float value() const { return float_from_le(body_.data()); }
+    long status() const { return i32_from_float(value()); }
+    constexpr Bytes uuid() const { return body_; }
+    constexpr uint8_t sensor_type() const { return body_[3]; }
+};
+
+// The reply of a batch read or a push, the field mask and a float per field
+class BatchReply : public Reply {
+public:
+    constexpr explicit BatchReply(Bytes frame) : Reply(frame)
+    {
+        valid_ = command() == CMD_EXT_BATCH && frame_.size() >= 2 && locate(1 + 4 * count(frame_[1]));
+    }
+
+    constexpr uint8_t fields() const { return body_[0]; }
+    constexpr bool has(uint8_t field) const { return (fields() & field) != 0; }
+
+    // The 4 bytes of a field flag, the fields follow in the order of their flags
+    constexpr Bytes raw(uint8_t field) const { return body_.sub(1 + 4 * count(fields() & (field - 1)), 4); }
+
+    float value(uint8_t field) const { return float_from_le(raw(field).data()); }
+
+private:
+    static constexpr size_t count(uint8_t mask)
+    {
+        size_t count = 0;
+        for (; mask; mask &= mask - 1) {
+            count++;
+        }
+        return count;
+    }
+};
+
+// The reply of a task statistics read, the times are in microseconds
+class TaskStatsReply : public Reply {
+public:
+    constexpr explicit TaskStatsReply(Bytes frame) : Reply(frame)
+    {
+        valid_ = command() == CMD_EXT_TASK_STATS && locate(TASK_STATS_SIZE - 2);
+    }
+
+    constexpr uint8_t task() const { return body_[0] & ~TASK_STATS_RESET; }
+    uint32_t exec_min() const { return field(0); }
+    uint32_t exec_max() const { return field(1); }
+    uint32_t exec_average() const { return field(2); }
+    uint32_t jitter_max() const { return field(3); }
+    uint32_t missed() const { return field(4); }
+    uint32_t backlog_max() const { return field(5); }
+
+private:
+    uint32_t field(size_t index) const { return u32_from_float(float_from_le(body_.data() + 1 + 4 * index)); }
+};
+
+// A history block, the keyframe and the delta samples that follow it, see history.h
+class HistoryBlock {
+public:
+    constexpr HistoryBlock() = default;
+    constexpr explicit HistoryBlock(Bytes bytes) : bytes_(bytes) {}
+
+    // A block shorter than its header has no keyframe, the fields read 0
+    constexpr uint32_t first() const { return bytes_.size() >= 5 ? u32_from_le(bytes_.data() + 1) : 0; }
+    constexpr fixed_t keyframe(size_t value) const
+    {
+        if (value >= HISTORY_VALUES || bytes_.size() < HISTORY_HEADER_SIZE) {
+            return 0;
+        }
+        return fixed_t(u16_from_le(bytes_.data() + 5 + 2 * value));
+    }
+
+    // Decode the samples one at a time, the keyframe first, returns false after the last sample or on a broken delta
+    class Cursor {
+    public:
+        constexpr explicit Cursor(const HistoryBlock &block) : block_(block.bytes_), offset_(0), number_(block.first()) {}
+
+        constexpr bool next(uint32_t &number, fixed_t (&values)[HISTORY_VALUES])
+        {
+            if (offset_ == 0) {
+                if (block_.size() < HISTORY_HEADER_SIZE) {
+                    return false;
+                }
+                for (size_t i = 0; i < HISTORY_VALUES; i++) {
+                    values_[i] = fixed_t(u16_from_le(block_.data() + 5 + 2 * i));
+                }
+                offset_ = HISTORY_HEADER_SIZE;
+            }
+            else {
+                if (offset_ >= block_.size()) {
+                    return false;
+                }
+                for (size_t i = 0; i < HISTORY_VALUES; i++) {
+                    uint16_t delta = 0;
+                    if (!varint(delta)) {
+                        offset_ = block_.size();
+                        return false;
+                    }
+                    values_[i] = fixed_t(uint16_t(values_[i]) + uint16_t((delta >> 1) ^ -(delta & 1)));
+                }
+                number_++;
+            }
+            number = number_;
+            for (size_t i = 0; i < HISTORY_VALUES; i++) {
+                values[i] = values_[i];
+            }
+            return true;
+        }
+
+    private:
+        // A zigzag varint of up to 3 bytes, the 16 bit delta of history.c
+        constexpr bool varint(uint16_t &value)
+        {
+            for (unsigned shift = 0; shift < 21 && offset_ < block_.size(); shift += 7) {
+                uint8_t data = block_[offset_++];
+                value |= uint16_t((data & 0x7F) << shift);
+                if (!(data & 0x80)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        Bytes block_;
+        size_t offset_;
+        uint32_t number_;
+        fixed_t values_[HISTORY_VALUES] = {};
+    };
+
+private:
+    Bytes bytes_;
+};
+
+// The reply of a history read, the blocks are walked in place from old to new
+class HistoryReply : public Reply {
+public:
+    // Valid when the length matches and the block sizes add up to it
+    constexpr explicit HistoryReply(Bytes frame) : Reply(frame)
+    {
+        if (command() != CMD_EXT_HISTORY || frame_.size() < HISTORY_DUMP_HEADER_SIZE ||
+            !locate(HISTORY_DUMP_HEADER_SIZE - 1 + u16_from_le(frame_.data() + 3))) {
+            return;
+        }
+        size_t offset = HISTORY_DUMP_HEADER_SIZE - 1;
+        size_t count = 0;
+        while (offset < body_.size()) {
+            if (body_[offset] < HISTORY_HEADER_SIZE || body_[offset] > body_.size() - offset) {
+                return;
+            }
+            offset += body_[offset];
+            count++;
+        }
+        valid_ = count == blocks();
+    }
+
+    constexpr uint8_t blocks() const { return body_[0]; }
+    constexpr uint8_t period() const { return body_[1]; }
+
+    // Step to the next block, offset starts at 0 and is advanced, returns false after the last block or when not valid
+    constexpr bool next(size_t &offset, HistoryBlock &block) const
+    {
+        size_t at = HISTORY_DUMP_HEADER_SIZE - 1 + offset;
+        if (!valid_ || at >= body_.size()) {
+            return false;
+        }
+        block = HistoryBlock(body_.sub(at, body_[at]));
+        offset += body_[at];
+        return true;
+    }
+};
+
+}
+
+#endif
@@ -0,0 +1,121 @@
+/*------------------------------------------------------------------*-
+
+  fuzz.cpp
+
+  libFuzzer entry point of the codec.  Every view is built on the
+  input and checked with valid(), a valid view has all of its fields
+  read, and the history blocks and samples are walked whatever the
+  input holds.  The input is a buffer of its exact size, so the
+  address sanitizer stops at the first byte a view reads outside of
+  it.
+
+  The input is also fed to a FrameParser as the bytes of a link.
+  Every frame it takes goes through the views as well, and has to
+  come back unchanged from encode() and a second parser.
+
+  Build and run, libFuzzer comes with clang:
+
+    make -C tools/codec fuzz
+    tools/codec/fuzz -max_len=1024 [corpus directory]
+
+-*------------------------------------------------------------------*/
+
+#include "codec.hpp"
+
+#include <cstdlib>
+
+using namespace codec;
+
+// Takes the fields, so the compiler keeps the reads
+static volatile uint32_t sink;
+
+// Decode every sample of a block
+static void walk(const HistoryBlock &block)
+{
+    HistoryBlock::Cursor cursor(block);
+    uint32_t number;
+    fixed_t values[HISTORY_VALUES];
+
+    sink = sink + block.first() + uint32_t(block.keyframe(0));
+    while (cursor.next(number, values)) {
+        for (size_t i = 0; i < HISTORY_VALUES; i++) {
+            sink = sink + number + uint32_t(values[i]);
+        }
+    }
+}
+
+// Build every view on a frame
+static void views(Bytes frame)
+{
+    WriteReply write(frame);
+    sink = sink + write.valid() + write.command() + write.error() + write.body().size();
+
+    ValueReply value(frame);
+    if (value.valid()) {
+        sink = sink + uint32_t(value.status()) + value.sensor_type() + value.uuid().size();
+    }
+
+    BatchReply batch(frame);
+    if (batch.valid()) {
+        for (unsigned field = 1; field <= 0x80; field <<= 1) {
+            if (batch.has(field)) {
+                sink = sink + u32_from_float(batch.value(field)) + batch.raw(field)[3];
+            }
+        }
+    }
+
+    TaskStatsReply stats(frame);
+    if (stats.valid()) {
+        sink = sink + stats.task() + stats.exec_min() + stats.exec_max() + stats.exec_average() + stats.jitter_max() +
+               stats.missed() + stats.backlog_max();
+    }
+
+    // The walk stops at once on an invalid reply
+    HistoryReply history(frame);
+    HistoryBlock block;
+    size_t offset = 0;
+    sink = sink + history.valid();
+    while (history.next(offset, block)) {
+        walk(block);
+    }
+
+    // A block taken straight from caller bytes, and the default block
+    walk(HistoryBlock(frame));
+    walk(HistoryBlock());
+}
+
+// A frame encoded again has to parse to the same frame
+static void round_trip(const Frame &frame)
+{
+    std::vector<uint8_t> bytes;
+    FrameParser parser;
+    Frame again;
+    size_t frames = 0;
+
+    encode(bytes, frame);
+    for (uint8_t data : bytes) {
+        if (parser.feed(data, again)) {
+            frames++;
+        }
+    }
+    if (frames != 1 || again.bus != frame.bus || again.address != frame.address || again.seq != frame.seq ||
+        again.content != frame.content) {
+        abort();
+    }
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    FrameParser parser;
+    Frame frame;
+
+    views(Bytes(data, size));
+
+    for (size_t i = 0; i < size; i++) {
+        if (parser.feed(data[i], frame)) {
+            views(Bytes(frame.content));
+            round_trip(frame);
+        }
+    }
+    return 0;
+}
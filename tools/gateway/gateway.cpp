@@ -0,0 +1,856 @@
+/*------------------------------------------------------------------*-
+
+  gateway.cpp
+
+  Gateway daemon that serves the stations of many serial links on a
+  single unix socket.  All links and clients are driven by one epoll
+  loop, so a slow station only delays its own requests.
+
+  A link is a serial device or pseudo-terminal with one station, or
+  with several stations on a multi-drop bus.  Requests to a station
+  on its own link are pipelined in v2 frames, up to the window, and
+  matched to the replies by sequence number.  A bus carries one
+  request at a time, the stations take turns.  A request without a
+  reply before the timeout fails, a late reply is dropped.  The
+  timeout is the time a station has to answer, the time the request
+  and its largest reply take on the line at the baud rate comes on
+  top.  A history dump is hundreds of bytes, a discovery reply waits
+  for the slot of its station.
+
+  Usage:
+
+    gateway [-s socket] [-b baud] [-t timeout ms] [-w window] link...
+
+    link      a device of one station, or device@a,b,... for the
+              stations with bus addresses a, b, ...
+
+  Clients send lines, every line starts with a tag that is repeated
+  in the answer:
+
+    <tag> list                  <tag> station <n> <device> <address>
+                                for every station, then <tag> ok
+    <tag> <n> <hex>             send the v1 frame without its stop
+                                byte to station n, answered with
+                                <tag> ok <hex reply> or <tag> timeout
+    <tag> bus <device> <hex>    broadcast the v1 frame on the bus of
+                                the device, answered with <tag> reply
+                                <address> <hex reply> for every station
+                                that answers, then <tag> done
+
+  A broadcast holds the bus until the last discovery slot is over,
+  so a discovery finds the stations the gateway was not started with
+  as well.  A bad line is answered with <tag> error station, <tag>
+  error link, <tag> error frame, or <tag> error closed when the link
+  of the station went away.
+
+  The frame may end with the index of a sensor after its content,
+  the trigger sensor commands then refer to that sensor instead of
+  the one selected on the station.  Clients that share a station
+  name the sensor in every request instead of selecting it.
+
+  Pushes of the stations go to every client as push <n> <hex>.
+  A client that closes its end after its lines still gets their
+  answers, the gateway closes the connection after the last one.
+
+-*------------------------------------------------------------------*/
+
+#include "codec.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace gateway {
+
+using codec::Frame;
+using codec::FrameParser;
+using Clock = std::chrono::steady_clock;
+
+// The host waits for the bus turnaround after the last byte of a station, like a station does after a request
+static constexpr std::chrono::microseconds BUS_GAP(BUS_TURNAROUND * 1024);
+
+// The time a discovery takes before the station in the last slot answers
+static constexpr std::chrono::microseconds DISCOVERY_TIME((BUS_TURNAROUND + BUS_SLOTS * BUS_SLOT) * 1024);
+
+// The largest history dump in bus framing, all blocks full
+static constexpr size_t HISTORY_REPLY_SIZE = FRAME_BUS_SIZE(HISTORY_DUMP_HEADER_SIZE + HISTORY_BLOCKS * HISTORY_BLOCK_SIZE + 1);
+
+struct Options {
+    std::string socket = "/tmp/gateway.sock";   // The path of the client socket
+    speed_t baud = B19200;                      // The rate of the serial links
+    long rate = 19200;                          // The same rate in bits per second
+    std::chrono::milliseconds timeout{200};     // The time a station has for a reply, the time on the line comes on top
+    size_t window = 4;                          // Requests in flight per station on its own link
+};
+
+struct Station;
+class Link;
+class Gateway;
+
+struct Request {
+    uint64_t client = 0;                // The client that asked, it may have left meanwhile
+    std::string tag;                    // The tag of the client line
+    Station *station = nullptr;         // The station, nullptr for a broadcast
+    std::vector<uint8_t> content;       // The v1 frame without the stop byte
+    Clock::time_point deadline;
+};
+
+struct Station {
+    int index = 0;                      // The number clients use
+    Link *link = nullptr;
+    uint8_t address = BUS_BROADCAST;    // The bus address, BUS_BROADCAST on a link of its own
+    std::deque<Request> queue;          // The requests that wait for the link
+};
+
+// Something the epoll loop waits for
+class Handler {
+public:
+    virtual ~Handler() = default;
+    virtual void on_event(uint32_t events) = 0;
+};
+
+// A client of the socket
+class Client : public Handler {
+public:
+    Client(Gateway &gateway, int fd, uint64_t id) : gateway_(gateway), fd_(fd), id_(id) {}
+    ~Client() override { close(fd_); }
+
+    void on_event(uint32_t events) override;
+    void send_line(const std::string &line);
+    void hold() { pending_++; }                         // A request of the client waits for its answer
+    void release();                                     // A request got its answer
+    int fd() const { return fd_; }
+
+private:
+    Gateway &gateway_;
+    int fd_;
+    uint64_t id_;
+    std::string in_;
+    std::string out_;
+    size_t pending_ = 0;                                // The requests without answer
+    bool closed_ = false;                               // Set when the client closed its end, it only waits for answers
+};
+
+// A serial link with its stations
+class Link : public Handler {
+public:
+    Link(Gateway &gateway, int fd, std::string path, bool bus)
+        : gateway_(gateway), fd_(fd), path_(std::move(path)), bus_(bus) {}
+    ~Link() override { close(fd_); }
+
+    void on_event(uint32_t events) override;
+    void broadcast(Request request);                    // Queue a broadcast on the bus
+    void pump();                                        // Send the requests the window allows
+    void expire(Clock::time_point now);                 // Fail the requests that ran out of time
+    bool next_deadline(Clock::time_point &deadline) const;  // The next timeout, or the end of the bus gap
+
+    int fd() const { return fd_; }
+    const std::string &path() const { return path_; }
+    bool bus() const { return bus_; }
+    std::vector<Station *> stations;
+
+private:
+    void receive(const Frame &frame);
+    void send(Request request, uint8_t address, Clock::time_point now);
+    void flush();
+    uint8_t next_seq();
+    Clock::duration line_time(const std::vector<uint8_t> &content, size_t sent) const;
+
+    Gateway &gateway_;
+    int fd_;
+    std::string path_;
+    bool bus_;
+    FrameParser parser_;
+    std::vector<uint8_t> out_;                          // Bytes the device did not take yet
+    std::deque<Request> broadcasts_;                    // The broadcasts that wait for the bus
+    std::map<uint8_t, Request> inflight_;               // The requests sent, by sequence number
+    uint8_t seq_ = FRAME_PUSH_SEQ;                      // The last sequence number
+    bool closed_ = false;                               // Set when the device went away
+    Clock::time_point quiet_;                           // The end of the bus gap after the last received byte
+    size_t turn_ = 0;                                   // The station of the next request on a bus
+};
+
+class Gateway {
+public:
+    explicit Gateway(Options options) : options_(std::move(options)) {}
+
+    bool open_link(const std::string &spec);
+    bool listen();
+    int run();
+
+    void watch(Handler *handler, int fd, uint32_t events);
+    void unwatch(int fd);
+    void client_line(uint64_t client, const std::string &line);
+    void client_left(uint64_t client);
+    void answer(const Request &request, const std::string &result, bool last = true);
+    void push(const Station &station, const std::vector<uint8_t> &content);
+
+    const Options &options() const { return options_; }
+
+private:
+    void accept_clients();
+
+    class Listener : public Handler {
+    public:
+        explicit Listener(Gateway &gateway) : gateway_(gateway) {}
+        void on_event(uint32_t) override { gateway_.accept_clients(); }
+
+    private:
+        Gateway &gateway_;
+    };
+
+    Options options_;
+    int epoll_ = -1;
+    int listener_ = -1;
+    Listener listener_handler_{*this};
+    std::vector<std::unique_ptr<Link>> links_;
+    std::vector<std::unique_ptr<Station>> stations_;
+    std::unordered_map<uint64_t, std::unique_ptr<Client>> clients_;
+    std::vector<std::unique_ptr<Client>> left_;         // Clients that left during this round of events
+    uint64_t next_client_ = 1;
+};
+
+static volatile sig_atomic_t stopping = 0;
+
+static std::string to_hex(const std::vector<uint8_t> &bytes)
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string hex;
+
+    for (uint8_t data : bytes) {
+        hex += digits[data >> 4];
+        hex += digits[data & 0x0F];
+    }
+    return hex;
+}
+
+static bool from_hex(const std::string &hex, std::vector<uint8_t> &bytes)
+{
+    if (hex.size() % 2) {
+        return false;
+    }
+    for (size_t i = 0; i < hex.size(); i += 2) {
+        if (!isxdigit((unsigned char) hex[i]) || !isxdigit((unsigned char) hex[i + 1])) {
+            return false;
+        }
+        bytes.push_back(strtoul(hex.substr(i, 2).c_str(), nullptr, 16));
+    }
+    return true;
+}
+
+// The frame of a request line, checked so a station never waits for missing content bytes, a sensor index may follow
+static bool frame_from(std::stringstream &words, std::vector<uint8_t> &content)
+{
+    std::string hex;
+
+    if (!(words >> hex) || !from_hex(hex, content) || content.empty()) {
+        return false;
+    }
+    size_t length = 1 + codec::content_length(content[0]);
+    return content.size() == length || content.size() == length + 1;
+}
+
+/*------------------------------------------------------------------*-
+  Client
+-*------------------------------------------------------------------*/
+
+void Client::on_event(uint32_t events)
+{
+    char buffer[1024];
+    ssize_t n;
+
+    if (events & EPOLLOUT) {
+        send_line("");
+    }
+    if (!(events & (EPOLLIN | EPOLLHUP | EPOLLERR))) {
+        return;
+    }
+    if (closed_) {
+        gateway_.client_left(id_); // The hangup of a client that waited for answers
+        return;
+    }
+
+    while ((n = read(fd_, buffer, sizeof(buffer))) > 0) {
+        in_.append(buffer, n);
+    }
+    if (n < 0 && errno != EAGAIN) {
+        gateway_.client_left(id_);
+        return;
+    }
+
+    // The lines before the end of the input still count
+    size_t end;
+    while ((end = in_.find('\n')) != std::string::npos) {
+        std::string line = in_.substr(0, end);
+        in_.erase(0, end + 1);
+        gateway_.client_line(id_, line);
+    }
+
+    // A client that closed its end leaves once its requests are answered
+    if (n == 0) {
+        closed_ = true;
+        if (pending_ == 0) {
+            gateway_.client_left(id_);
+        }
+        else {
+            send_line("");
+        }
+    }
+}
+
+void Client::release()
+{
+    if (--pending_ == 0 && closed_) {
+        gateway_.client_left(id_);
+    }
+}
+
+// Queue a line for the client, an empty line only flushes
+void Client::send_line(const std::string &line)
+{
+    if (!line.empty()) {
+        out_ += line;
+        out_ += '\n';
+    }
+    while (!out_.empty()) {
+        ssize_t n = write(fd_, out_.data(), out_.size());
+        if (n <= 0) {
+            break;
+        }
+        out_.erase(0, n);
+    }
+    gateway_.watch(this, fd_, (closed_ ? 0u : uint32_t(EPOLLIN)) | (out_.empty() ? 0u : uint32_t(EPOLLOUT)));
+}
+
+/*------------------------------------------------------------------*-
+  Link
+-*------------------------------------------------------------------*/
+
+void Link::on_event(uint32_t events)
+{
+    uint8_t buffer[256];
+    ssize_t n;
+    Frame frame;
+
+    if (events & EPOLLOUT) {
+        flush();
+    }
+    while ((n = read(fd_, buffer, sizeof(buffer))) > 0) {
+        quiet_ = Clock::now() + BUS_GAP;
+        for (ssize_t i = 0; i < n; i++) {
+            if (parser_.feed(buffer[i], frame)) {
+                receive(frame);
+            }
+        }
+    }
+
+    // The requests in flight on a link that went away time out, the waiting ones fail in pump
+    if (n == 0 || (n < 0 && errno != EAGAIN)) {
+        fprintf(stderr, "gateway: %s closed\n", path_.c_str());
+        gateway_.unwatch(fd_);
+        closed_ = true;
+    }
+    pump();
+}
+
+// Hand a reply to the request with its sequence number, and a push to the clients
+void Link::receive(const Frame &frame)
+{
+    Station *from = nullptr;
+
+    if (frame.bus != bus_) {
+        return;
+    }
+
+    // Every station that takes a broadcast answers it, also the ones the gateway does not serve
+    auto it = inflight_.find(frame.seq);
+    if (frame.seq != FRAME_PUSH_SEQ && it != inflight_.end() && !it->second.station) {
+        gateway_.answer(it->second, "reply " + std::to_string(frame.address) + " " + to_hex(frame.content), false);
+        return;
+    }
+
+    for (Station *station : stations) {
+        if (station->address == frame.address) {
+            from = station;
+        }
+    }
+    if (!from) {
+        return;
+    }
+
+    if (frame.seq == FRAME_PUSH_SEQ) {
+        gateway_.push(*from, frame.content);
+        return;
+    }
+
+    if (it == inflight_.end() || it->second.station != from) {
+        return; // A late reply of a request that timed out
+    }
+    gateway_.answer(it->second, "ok " + to_hex(frame.content));
+    inflight_.erase(it);
+}
+
+// The next free sequence number, FRAME_PUSH_SEQ is never used for a request
+uint8_t Link::next_seq()
+{
+    do {
+        seq_++;
+    } while (seq_ == FRAME_PUSH_SEQ || inflight_.count(seq_));
+    return seq_;
+}
+
+void Link::broadcast(Request request)
+{
+    broadcasts_.push_back(std::move(request));
+    pump();
+}
+
+void Link::pump()
+{
+    Clock::time_point now = Clock::now();
+    size_t idle = 0;   // Stations in a row without a request
+
+    if (closed_) {
+        for (Station *station : stations) {
+            for (const Request &request : station->queue) {
+                gateway_.answer(request, "error closed");
+            }
+            station->queue.clear();
+        }
+        for (const Request &request : broadcasts_) {
+            gateway_.answer(request, "error closed");
+        }
+        broadcasts_.clear();
+        return;
+    }
+
+    // A broadcast goes first, it holds the bus until its deadline
+    if (inflight_.empty() && now >= quiet_ && !broadcasts_.empty()) {
+        send(std::move(broadcasts_.front()), BUS_BROADCAST, now);
+        broadcasts_.pop_front();
+    }
+
+    // A bus carries one request at a time and the stations take turns, a station of its own takes a window of them
+    while (idle < stations.size() &&
+           (bus_ ? inflight_.empty() && now >= quiet_ : inflight_.size() < gateway_.options().window)) {
+        Station *station = stations[turn_];
+        if (bus_ || station->queue.empty()) {
+            turn_ = (turn_ + 1) % stations.size();
+        }
+        if (station->queue.empty()) {
+            idle++;
+            continue;
+        }
+        idle = 0;
+
+        Request request = std::move(station->queue.front());
+        station->queue.pop_front();
+        send(std::move(request), station->address, now);
+    }
+    flush();
+}
+
+// Queue the frame of a request and keep the request in flight until its deadline
+void Link::send(Request request, uint8_t address, Clock::time_point now)
+{
+    Frame frame;
+    frame.bus = bus_;
+    frame.address = address;
+    frame.seq = next_seq();
+    frame.content = request.content;
+    size_t sent = out_.size();
+    codec::encode(out_, frame);
+
+    // A station answers in order, the reply waits for the replies before it
+    Clock::time_point start = now;
+    for (const auto &entry : inflight_) {
+        start = std::max(start, entry.second.deadline - gateway_.options().timeout);
+    }
+    request.deadline = start + gateway_.options().timeout + line_time(request.content, out_.size() - sent);
+    inflight_.emplace(frame.seq, std::move(request));
+}
+
+// The time the request of the amount of bytes sent and its largest reply take on the line
+Clock::duration Link::line_time(const std::vector<uint8_t> &content, size_t sent) const
+{
+    size_t bytes = sent + (content[0] == CMD_EXT_HISTORY ? HISTORY_REPLY_SIZE : REPLY_MAX_SIZE);
+    Clock::duration time = std::chrono::microseconds(bytes * 10 * 1000000 / gateway_.options().rate);
+
+    return content[0] == CMD_EXT_DISCOVER ? time + DISCOVERY_TIME : time;
+}
+
+void Link::flush()
+{
+    if (closed_) {
+        out_.clear();
+        return;
+    }
+    while (!out_.empty()) {
+        ssize_t n = write(fd_, out_.data(), out_.size());
+        if (n <= 0) {
+            break;
+        }
+        out_.erase(out_.begin(), out_.begin() + n);
+    }
+    gateway_.watch(this, fd_, EPOLLIN | (out_.empty() ? 0u : uint32_t(EPOLLOUT)));
+}
+
+void Link::expire(Clock::time_point now)
+{
+    for (auto it = inflight_.begin(); it != inflight_.end();) {
+        if (it->second.deadline <= now) {
+            gateway_.answer(it->second, it->second.station ? "timeout" : "done");
+            it = inflight_.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+
+    // The freed window, or the bus at the end of its gap, takes the next requests
+    pump();
+}
+
+bool Link::next_deadline(Clock::time_point &deadline) const
+{
+    bool found = false;
+
+    for (const auto &entry : inflight_) {
+        if (!found || entry.second.deadline < deadline) {
+            deadline = entry.second.deadline;
+            found = true;
+        }
+    }
+
+    // A bus with waiting requests wakes up at the end of the gap
+    if (bus_ && !found && quiet_ > Clock::now()) {
+        if (!broadcasts_.empty()) {
+            deadline = quiet_;
+            return true;
+        }
+        for (const Station *station : stations) {
+            if (!station->queue.empty()) {
+                deadline = quiet_;
+                return true;
+            }
+        }
+    }
+    return found;
+}
+
+/*------------------------------------------------------------------*-
+  Gateway
+-*------------------------------------------------------------------*/
+
+// Open a link, device for one station or device@a,b,... for bus stations
+bool Gateway::open_link(const std::string &spec)
+{
+    std::string path = spec;
+    std::vector<uint8_t> addresses;
+    size_t at = spec.find('@');
+    struct termios tio;
+
+    if (at != std::string::npos) {
+        std::stringstream list(spec.substr(at + 1));
+        std::string item;
+        path = spec.substr(0, at);
+        while (std::getline(list, item, ',')) {
+            int address = atoi(item.c_str());
+            if (address <= BUS_BROADCAST || address > BUS_ADDRESS_MAX) {
+                fprintf(stderr, "gateway: invalid bus address %s\n", item.c_str());
+                return false;
+            }
+            addresses.push_back(address);
+        }
+    }
+
+    int fd = open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd < 0) {
+        perror(path.c_str());
+        return false;
+    }
+    if (tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, options_.baud);
+        cfsetospeed(&tio, options_.baud);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+
+    auto link = std::make_unique<Link>(*this, fd, path, !addresses.empty());
+    if (addresses.empty()) {
+        addresses.push_back(BUS_BROADCAST);
+    }
+    for (uint8_t address : addresses) {
+        auto station = std::make_unique<Station>();
+        station->index = stations_.size();
+        station->link = link.get();
+        station->address = address;
+        link->stations.push_back(station.get());
+        stations_.push_back(std::move(station));
+    }
+    links_.push_back(std::move(link));
+    return true;
+}
+
+bool Gateway::listen()
+{
+    struct sockaddr_un addr = {};
+
+    epoll_ = epoll_create1(0);
+    listener_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, options_.socket.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(options_.socket.c_str());
+    if (epoll_ < 0 || listener_ < 0 || bind(listener_, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        ::listen(listener_, 16) < 0) {
+        perror("gateway: socket");
+        return false;
+    }
+
+    watch(&listener_handler_, listener_, EPOLLIN);
+    for (auto &link : links_) {
+        watch(link.get(), link->fd(), EPOLLIN);
+    }
+    return true;
+}
+
+// Add a descriptor to the loop or change the events it waits for
+void Gateway::watch(Handler *handler, int fd, uint32_t events)
+{
+    struct epoll_event event = {};
+
+    event.events = events;
+    event.data.ptr = handler;
+    if (epoll_ctl(epoll_, EPOLL_CTL_MOD, fd, &event) < 0 && errno == ENOENT) {
+        epoll_ctl(epoll_, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+void Gateway::unwatch(int fd)
+{
+    epoll_ctl(epoll_, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+void Gateway::accept_clients()
+{
+    int fd;
+
+    while ((fd = accept4(listener_, nullptr, nullptr, SOCK_NONBLOCK)) >= 0) {
+        uint64_t id = next_client_++;
+        auto client = std::make_unique<Client>(*this, fd, id);
+        watch(client.get(), fd, EPOLLIN);
+        clients_.emplace(id, std::move(client));
+    }
+}
+
+void Gateway::client_left(uint64_t client)
+{
+    auto it = clients_.find(client);
+
+    if (it != clients_.end()) {
+        unwatch(it->second->fd());
+        // Events of this round may still point at the client
+        left_.push_back(std::move(it->second));
+        clients_.erase(it);
+    }
+}
+
+void Gateway::client_line(uint64_t client, const std::string &line)
+{
+    std::stringstream words(line);
+    std::string tag, target;
+    Client &out = *clients_.at(client);
+    Request request;
+
+    if (!(words >> tag >> target)) {
+        return;
+    }
+
+    if (target == "list") {
+        for (auto &station : stations_) {
+            out.send_line(tag + " station " + std::to_string(station->index) + " " + station->link->path() + " " +
+                          std::to_string(station->address));
+        }
+        out.send_line(tag + " ok");
+        return;
+    }
+
+    request.client = client;
+    request.tag = tag;
+
+    if (target == "bus") {
+        std::string path;
+        words >> path;
+        auto link = std::find_if(links_.begin(), links_.end(), [&](const std::unique_ptr<Link> &candidate) {
+            return candidate->bus() && candidate->path() == path;
+        });
+        if (link == links_.end()) {
+            out.send_line(tag + " error link");
+            return;
+        }
+        if (!frame_from(words, request.content)) {
+            out.send_line(tag + " error frame");
+            return;
+        }
+        out.hold();
+        (*link)->broadcast(std::move(request));
+        return;
+    }
+
+    char *end = nullptr;
+    unsigned long index = strtoul(target.c_str(), &end, 10);
+    if (*end || index >= stations_.size()) {
+        out.send_line(tag + " error station");
+        return;
+    }
+    if (!frame_from(words, request.content)) {
+        out.send_line(tag + " error frame");
+        return;
+    }
+
+    request.station = stations_[index].get();
+    request.station->queue.push_back(std::move(request));
+    out.hold();
+    stations_[index]->link->pump();
+}
+
+// Answer a request, the last answer of a broadcast ends it
+void Gateway::answer(const Request &request, const std::string &result, bool last)
+{
+    auto it = clients_.find(request.client);
+
+    if (it != clients_.end()) {
+        it->second->send_line(request.tag + " " + result);
+        if (last) {
+            it->second->release();
+        }
+    }
+}
+
+void Gateway::push(const Station &station, const std::vector<uint8_t> &content)
+{
+    std::string line = "push " + std::to_string(station.index) + " " + to_hex(content);
+
+    for (auto &client : clients_) {
+        client.second->send_line(line);
+    }
+}
+
+int Gateway::run()
+{
+    struct epoll_event events[64];
+
+    while (!stopping) {
+        // Wake up for the first deadline of a request in flight
+        Clock::time_point now = Clock::now(), deadline;
+        int timeout = -1;
+        for (auto &link : links_) {
+            Clock::time_point next;
+            if (link->next_deadline(next) && (timeout < 0 || next < deadline)) {
+                deadline = next;
+                timeout = std::chrono::ceil<std::chrono::milliseconds>(std::max(next - now, Clock::duration::zero())).count();
+            }
+        }
+
+        int n = epoll_wait(epoll_, events, 64, timeout);
+        if (n < 0 && errno != EINTR) {
+            perror("gateway: epoll");
+            return 1;
+        }
+        for (int i = 0; i < n; i++) {
+            static_cast<Handler *>(events[i].data.ptr)->on_event(events[i].events);
+        }
+        left_.clear();
+
+        now = Clock::now();
+        for (auto &link : links_) {
+            link->expire(now);
+        }
+    }
+
+    unlink(options_.socket.c_str());
+    return 0;
+}
+
+}
+
+using namespace gateway;
+
+static speed_t baud_constant(long baud)
+{
+    switch (baud) {
+        case 19200: return B19200;
+        case 38400: return B38400;
+        case 57600: return B57600;
+        case 115200: return B115200;
+        case 230400: return B230400;
+        case 500000: return B500000;
+        case 1000000: return B1000000;
+        default: return 0;
+    }
+}
+
+static void stop(int)
+{
+    stopping = 1;
+}
+
+int main(int argc, char **argv)
+{
+    Options options;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:b:t:w:")) != -1) {
+        switch (opt) {
+            case 's': options.socket = optarg; break;
+            case 'b':
+                options.rate = atol(optarg);
+                options.baud = baud_constant(options.rate);
+                break;
+            case 't': options.timeout = std::chrono::milliseconds(atol(optarg)); break;
+            case 'w': options.window = atol(optarg); break;
+            default: optind = argc + 1; break;
+        }
+    }
+    if (optind >= argc || !options.baud || options.window == 0 || options.timeout.count() <= 0) {
+        fprintf(stderr, "usage: gateway [-s socket] [-b baud] [-t timeout ms] [-w window] device[@address,...]...\n");
+        return 2;
+    }
+
+    Gateway gateway(options);
+    for (int i = optind; i < argc; i++) {
+        if (!gateway.open_link(argv[i])) {
+            return 1;
+        }
+    }
+    if (!gateway.listen()) {
+        return 1;
+    }
+
+    struct sigaction action = {};
+    action.sa_handler = stop;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    signal(SIGPIPE, SIG_IGN);
+
+    return gateway.run();
+}